@@ -0,0 +1,623 @@
+/* ext4_bench.c - Host side lwext4 benchmark on a raw ext4 image.
+ * Copyright (c) 2022-2024, Warren Watson.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice, development funding notice, and this permission
+ * notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+//**************************************************************
+// Host version of EXT4benchGIGA.ino. Runs the same kind of     *
+// sequential write/read test plus small record and metadata    *
+// workloads directly against lwext4 and a file_dev image.      *
+//                                                              *
+//   truncate -s 256M ext4.img                                  *
+//   mkfs.ext4 -F -b 4096 -L bench ext4.img                     *
+//   ext4_bench ext4.img                                        *
+//   e2fsck -fn ext4.img                                        *
+//**************************************************************
+#define _GNU_SOURCE
+
+#include "ext4/ext4.h"
+#include "ext4/ext4_mbr.h"
+#include "file_dev.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MOUNT_POINT "/mp/"
+#define DEV_NAME "ext4_fs"
+#define DEEP_PATH "bench_dir/logs/2024/06/15/sensor/data.csv"
+
+// Configuration, set from the command line.
+static const char *image;
+static int partition;                    // 0 = whole image, 1..4 = MBR entry.
+static uint32_t file_size_mb = 5;        // MB = 1,000,000 bytes.
+static size_t buf_size = 32 * 1024;      // Sequential read/write buffer.
+static size_t rec_size = 64;             // Small record size.
+static uint32_t file_count = 200;        // Metadata test file count.
+static uint32_t latency_us;              // Emulated device latency.
+static uint32_t max_xfer = 255;          // Max sectors per device command.
+static bool async;                       // Use submit/wait device hooks.
+static struct ext4_mount_opts mount_opts; // Block cache size.
+static bool prealloc;                    // fallocate the record file first.
+static uint32_t stream_bytes;            // Append stream mode of the record
+static uint32_t stream_ms;               // file (ext4_fstream).
+
+static struct ext4_blockdev *bd;
+static struct ext4_mbr_bdevs bdevs;
+static uint8_t *buf;
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+//******************************************************************************
+// Per phase report. Device command counts come from the interface counters.
+//******************************************************************************
+static uint32_t rd_mark, wr_mark;
+static uint64_t t_mark;
+
+static void phase_start(void)
+{
+	rd_mark = bd->bdif->bread_ctr;
+	wr_mark = bd->bdif->bwrite_ctr;
+	t_mark = now_us();
+}
+
+static void phase_end(const char *name, uint64_t bytes, uint32_t ops)
+{
+	uint64_t t = now_us() - t_mark;
+	if (!t)
+		t = 1;
+
+	printf("%-14s %10.3f ms", name, t / 1000.0);
+	if (bytes)
+		printf(" %10.1f KB/s", (double)bytes * 1000000.0 / 1024.0 / t);
+	if (ops)
+		printf(" %10.1f ops/s", (double)ops * 1000000.0 / t);
+	printf("   bread %" PRIu32 ", bwrite %" PRIu32 "\n",
+	       bd->bdif->bread_ctr - rd_mark, bd->bdif->bwrite_ctr - wr_mark);
+}
+
+static void fill_pattern(uint8_t *p, size_t len, uint64_t pos)
+{
+	for (size_t i = 0; i < len; i++)
+		p[i] = (uint8_t)('A' + ((pos + i) % 26));
+}
+
+static int check_pattern(const uint8_t *p, size_t len, uint64_t pos)
+{
+	for (size_t i = 0; i < len; i++)
+		if (p[i] != (uint8_t)('A' + ((pos + i) % 26)))
+			return -1;
+	return 0;
+}
+
+//******************************************************************************
+// Mount/umount. Same sequence as GIGAext4::lwext_mount()/lwext_umount().
+//******************************************************************************
+static int bench_mount(void)
+{
+	struct ext4_blockdev *mbd = bd;
+	int r;
+
+	if (partition) {
+		r = ext4_mbr_scan(bd, &bdevs);
+		if (r != EOK) {
+			printf("ext4_mbr_scan: rc = %d\n", r);
+			return r;
+		}
+		mbd = &bdevs.partitions[partition - 1];
+		if (!mbd->bdif) {
+			printf("partition %d not found\n", partition);
+			return ENODEV;
+		}
+	}
+
+	r = ext4_device_register(mbd, DEV_NAME);
+	if (r != EOK) {
+		printf("ext4_device_register: rc = %d\n", r);
+		return r;
+	}
+	r = ext4_mount_ex(DEV_NAME, MOUNT_POINT, &mount_opts);
+	if (r != EOK) {
+		printf("ext4_mount: rc = %d\n", r);
+		ext4_device_unregister(DEV_NAME);
+		return r;
+	}
+	r = ext4_recover(MOUNT_POINT);
+	if (r != EOK && r != ENOTSUP) {
+		printf("ext4_recover: rc = %d\n", r);
+		return r;
+	}
+	ext4_cache_write_back(MOUNT_POINT, 1);
+	return EOK;
+}
+
+//******************************************************************************
+// Cache and device statistics of the whole run (ext4_mount_point_io_stats()).
+//******************************************************************************
+static void print_io_stats(void)
+{
+	struct ext4_io_stats s;
+
+	if (ext4_mount_point_io_stats(MOUNT_POINT, &s) != EOK)
+		return;
+
+	printf("cache hits         %" PRIu32 ", misses %" PRIu32
+	       ", evictions %" PRIu32 " (dirty %" PRIu32 ")\n",
+	       s.cache_hits, s.cache_misses, s.evictions, s.dirty_evictions);
+	printf("readahead          %" PRIu32 " reads, %" PRIu32 " blocks\n",
+	       s.readaheads, s.readahead_blocks);
+	printf("write back         %" PRIu32 " transfers, %" PRIu32
+	       " blocks, max %" PRIu32 " blocks per transfer\n",
+	       s.flushes, s.flush_blocks, s.flush_max_blocks);
+	printf("device reads       %" PRIu32 ", %" PRIu64 " KB, %.3f ms\n",
+	       s.reads, s.read_bytes / 1024, s.read_time_us / 1000.0);
+	printf("device writes      %" PRIu32 ", %" PRIu64 " KB, %.3f ms\n",
+	       s.writes, s.write_bytes / 1024, s.write_time_us / 1000.0);
+}
+
+static int bench_umount(void)
+{
+	int r;
+	struct ext4_cache_info ci;
+
+	if (ext4_mount_point_cache_info(MOUNT_POINT, &ci) == EOK)
+		printf("cache              %" PRIu32 " blocks of %" PRIu32
+		       ", max referenced %" PRIu32 "\n", ci.cache_blocks,
+		       ci.block_size, ci.max_ref_blocks);
+	print_io_stats();
+
+	phase_start();
+	ext4_cache_write_back(MOUNT_POINT, 0);
+	r = ext4_umount(MOUNT_POINT);
+	phase_end("umount", 0, 0);
+	if (r != EOK)
+		printf("ext4_umount: rc = %d\n", r);
+	ext4_device_unregister(DEV_NAME);
+	return r;
+}
+
+//******************************************************************************
+// Sequential write/read of one big file, buf_size bytes per call.
+//******************************************************************************
+static int bench_sequential(void)
+{
+	ext4_file f;
+	size_t n;
+	uint64_t pos;
+	uint64_t size = (uint64_t)file_size_mb * 1000000u;
+	uint64_t lmax = 0, lmin = UINT64_MAX, t;
+	int r;
+
+	size -= size % buf_size;
+	r = ext4_fopen(&f, MOUNT_POINT "bench.dat", "w+");
+	if (r != EOK) {
+		printf("ext4_fopen: rc = %d\n", r);
+		return r;
+	}
+
+	phase_start();
+	for (pos = 0; pos < size; pos += buf_size) {
+		fill_pattern(buf, buf_size, pos);
+		t = now_us();
+		r = ext4_fwrite(&f, buf, buf_size, &n);
+		t = now_us() - t;
+		if (r != EOK || n != buf_size) {
+			printf("write failed: rc = %d\n", r);
+			ext4_fclose(&f);
+			return r ? r : EIO;
+		}
+		lmax = t > lmax ? t : lmax;
+		lmin = t < lmin ? t : lmin;
+	}
+	ext4_cache_flush(MOUNT_POINT);
+	phase_end("seq write", size, 0);
+	printf("%-14s max %" PRIu64 " us, min %" PRIu64 " us\n", "", lmax, lmin);
+
+	ext4_fseek(&f, 0, SEEK_SET);
+	lmax = 0;
+	lmin = UINT64_MAX;
+	phase_start();
+	for (pos = 0; pos < size; pos += buf_size) {
+		t = now_us();
+		r = ext4_fread(&f, buf, buf_size, &n);
+		t = now_us() - t;
+		if (r != EOK || n != buf_size) {
+			printf("read failed: rc = %d\n", r);
+			ext4_fclose(&f);
+			return r ? r : EIO;
+		}
+		if (check_pattern(buf, buf_size, pos)) {
+			printf("data check error at %" PRIu64 "\n", pos);
+			ext4_fclose(&f);
+			return EIO;
+		}
+		lmax = t > lmax ? t : lmax;
+		lmin = t < lmin ? t : lmin;
+	}
+	phase_end("seq read", size, 0);
+	printf("%-14s max %" PRIu64 " us, min %" PRIu64 " us\n", "", lmax, lmin);
+
+	return ext4_fclose(&f);
+}
+
+//******************************************************************************
+// Data logger pattern: many small appends, then small record reads.
+//******************************************************************************
+static int bench_records(void)
+{
+	ext4_file f;
+	size_t n;
+	uint64_t pos;
+	uint64_t size = 1000000u;
+	uint32_t ops = 0;
+	int r;
+
+	size -= size % rec_size;
+	r = ext4_fopen(&f, MOUNT_POINT "records.csv", "w+");
+	if (r != EOK) {
+		printf("ext4_fopen: rc = %d\n", r);
+		return r;
+	}
+
+	if (prealloc) {
+		// Logger pattern: reserve the whole file, appends then only
+		// convert unwritten extents.
+		phase_start();
+		r = ext4_fallocate(&f, 0, size, EXT4_FALLOC_KEEP_SIZE);
+		if (r != EOK) {
+			printf("ext4_fallocate: rc = %d\n", r);
+			ext4_fclose(&f);
+			return r;
+		}
+		ext4_cache_flush(MOUNT_POINT);
+		phase_end("fallocate", 0, 0);
+	}
+
+	if (stream_bytes) {
+		r = ext4_fstream(&f, stream_bytes, stream_ms);
+		if (r != EOK) {
+			printf("ext4_fstream: rc = %d\n", r);
+			ext4_fclose(&f);
+			return r;
+		}
+	}
+
+	phase_start();
+	for (pos = 0; pos < size; pos += rec_size, ops++) {
+		fill_pattern(buf, rec_size, pos);
+		r = ext4_fwrite(&f, buf, rec_size, &n);
+		if (r != EOK || n != rec_size) {
+			printf("record write failed: rc = %d\n", r);
+			ext4_fclose(&f);
+			return r ? r : EIO;
+		}
+	}
+	ext4_cache_flush(MOUNT_POINT);
+	phase_end("record append", size, ops);
+
+	ext4_fseek(&f, 0, SEEK_SET);
+	ops = 0;
+	phase_start();
+	for (pos = 0; pos < size; pos += rec_size, ops++) {
+		r = ext4_fread(&f, buf, rec_size, &n);
+		if (r != EOK || n != rec_size || check_pattern(buf, rec_size, pos)) {
+			printf("record read failed at %" PRIu64 ": rc = %d\n", pos, r);
+			ext4_fclose(&f);
+			return r ? r : EIO;
+		}
+	}
+	phase_end("record read", size, ops);
+
+	return ext4_fclose(&f);
+}
+
+//******************************************************************************
+// Blocks preallocated past the end of file are freed by remove and by a
+// truncate to the same size (free block count before and after).
+//******************************************************************************
+static uint64_t free_blocks(void)
+{
+	struct ext4_mount_stats st;
+
+	if (ext4_mount_point_stats(MOUNT_POINT, &st) != EOK)
+		return 0;
+	return st.free_blocks_count;
+}
+
+static int bench_prealloc_free(void)
+{
+	ext4_file f;
+	size_t n;
+	uint64_t free0, free1;
+	int r;
+
+	phase_start();
+	free0 = free_blocks();
+	r = ext4_fopen(&f, MOUNT_POINT "prealloc.bin", "w");
+	if (r != EOK) {
+		printf("ext4_fopen: rc = %d\n", r);
+		return r;
+	}
+	r = ext4_fallocate(&f, 0, 65536, EXT4_FALLOC_KEEP_SIZE);
+	if (r == EOK)
+		r = ext4_fclose(&f);
+	else
+		ext4_fclose(&f);
+	if (r == EOK)
+		r = ext4_fremove(MOUNT_POINT "prealloc.bin");
+	if (r != EOK) {
+		printf("prealloc remove: rc = %d\n", r);
+		return r;
+	}
+	free1 = free_blocks();
+	if (free1 != free0) {
+		printf("prealloc remove: %" PRIu64 " blocks leaked\n",
+		       free0 - free1);
+		return EIO;
+	}
+
+	// Only the block holding the data stays.
+	r = ext4_fopen(&f, MOUNT_POINT "prealloc.bin", "w");
+	if (r != EOK) {
+		printf("ext4_fopen: rc = %d\n", r);
+		return r;
+	}
+	fill_pattern(buf, rec_size, 0);
+	r = ext4_fwrite(&f, buf, rec_size, &n);
+	if (r == EOK)
+		r = ext4_fallocate(&f, 0, 65536, EXT4_FALLOC_KEEP_SIZE);
+	if (r == EOK)
+		r = ext4_ftruncate(&f, ext4_fsize(&f));
+	free1 = free_blocks();
+	if (r == EOK)
+		r = ext4_fclose(&f);
+	else
+		ext4_fclose(&f);
+	if (r != EOK) {
+		printf("prealloc truncate: rc = %d\n", r);
+		return r;
+	}
+	if (free1 != free0 - 1) {
+		printf("prealloc truncate: %" PRIu64 " blocks kept, expected 1\n",
+		       free0 - free1);
+		return EIO;
+	}
+	r = ext4_fremove(MOUNT_POINT "prealloc.bin");
+	if (r != EOK) {
+		printf("prealloc remove: rc = %d\n", r);
+		return r;
+	}
+	ext4_cache_flush(MOUNT_POINT);
+	phase_end("prealloc free", 0, 0);
+
+	return EOK;
+}
+
+//******************************************************************************
+// Metadata: create, look up, list and remove file_count files.
+//******************************************************************************
+static int bench_metadata(void)
+{
+	char path[64];
+	ext4_file f;
+	ext4_dir d;
+	uint32_t i, cnt = 0;
+	int r;
+
+	r = ext4_dir_mk(MOUNT_POINT "bench_dir");
+	if (r != EOK) {
+		printf("ext4_dir_mk: rc = %d\n", r);
+		return r;
+	}
+
+	phase_start();
+	for (i = 0; i < file_count; i++) {
+		snprintf(path, sizeof(path), MOUNT_POINT "bench_dir/file_%05" PRIu32 ".txt", i);
+		r = ext4_fopen(&f, path, "w");
+		if (r != EOK) {
+			printf("create %s: rc = %d\n", path, r);
+			return r;
+		}
+		ext4_fwrite(&f, path, strlen(path), NULL);
+		ext4_fclose(&f);
+	}
+	ext4_cache_flush(MOUNT_POINT);
+	phase_end("create", 0, file_count);
+
+	phase_start();
+	for (i = 0; i < file_count; i++) {
+		snprintf(path, sizeof(path), MOUNT_POINT "bench_dir/file_%05" PRIu32 ".txt", i);
+		r = ext4_inode_exist(path, EXT4_DE_REG_FILE);
+		if (r != EOK) {
+			printf("lookup %s: rc = %d\n", path, r);
+			return r;
+		}
+	}
+	phase_end("lookup", 0, file_count);
+
+	// Same leaf over and over: the path walk of a logger reopening its file.
+	r = ext4_fopen(&f, MOUNT_POINT DEEP_PATH, "w");
+	if (r != EOK) {
+		printf("create %s: rc = %d\n", DEEP_PATH, r);
+		return r;
+	}
+	ext4_fclose(&f);
+
+	phase_start();
+	for (i = 0; i < file_count; i++) {
+		r = ext4_inode_exist(MOUNT_POINT DEEP_PATH, EXT4_DE_REG_FILE);
+		if (r != EOK) {
+			printf("lookup %s: rc = %d\n", DEEP_PATH, r);
+			return r;
+		}
+	}
+	phase_end("deep lookup", 0, file_count);
+
+	phase_start();
+	r = ext4_dir_open(&d, MOUNT_POINT "bench_dir");
+	if (r != EOK)
+		return r;
+	while (ext4_dir_entry_next(&d))
+		cnt++;
+	ext4_dir_close(&d);
+	phase_end("list", 0, cnt);
+	// Files plus ".", ".." and the "logs" tree.
+	if (cnt != file_count + 3) {
+		printf("list: %" PRIu32 " entries, expected %" PRIu32 "\n",
+		       cnt, file_count + 3);
+		return EIO;
+	}
+
+	phase_start();
+	for (i = 0; i < file_count; i++) {
+		snprintf(path, sizeof(path), MOUNT_POINT "bench_dir/file_%05" PRIu32 ".txt", i);
+		r = ext4_fremove(path);
+		if (r != EOK) {
+			printf("remove %s: rc = %d\n", path, r);
+			return r;
+		}
+	}
+	ext4_cache_flush(MOUNT_POINT);
+	phase_end("remove", 0, file_count);
+
+	return ext4_dir_rm(MOUNT_POINT "bench_dir");
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [options] <image>\n"
+	       "  -p <n>   mount MBR partition n (1..4), default whole image\n"
+	       "  -s <MB>  sequential test file size in MB (default %" PRIu32 ")\n"
+	       "  -b <n>   sequential read/write buffer size (default %zu)\n"
+	       "  -r <n>   record size of the append test (default %zu)\n"
+	       "  -n <n>   file count of the metadata test (default %" PRIu32 ")\n"
+	       "  -l <us>  emulated per-command device latency (default 0)\n"
+	       "  -x <n>   max sectors per device command (default %" PRIu32 ", 0 = no limit)\n"
+	       "  -a       asynchronous device (submit/wait hooks, worker thread)\n"
+	       "  -c <n>   block cache size in blocks (default CONFIG_BLOCK_DEV_CACHE_SIZE)\n"
+	       "  -C <n>   block cache memory budget in bytes\n"
+	       "  -D <n>   delayed allocation buffer per open file in bytes (default 0 = off)\n"
+	       "  -P       preallocate the record file (ext4_fallocate, keep size)\n"
+	       "  -S <n>[:<ms>] append stream mode of the record file, buffer bytes\n"
+	       "           and write back interval (ext4_fstream)\n",
+	       prog, file_size_mb, buf_size, rec_size, file_count, max_xfer);
+}
+
+int main(int argc, char **argv)
+{
+	int c, r;
+
+	while ((c = getopt(argc, argv, "p:s:b:r:n:l:x:ac:C:D:PS:h")) != -1) {
+		switch (c) {
+		case 'p':
+			partition = atoi(optarg);
+			break;
+		case 's':
+			file_size_mb = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			buf_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rec_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			file_count = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			latency_us = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'x':
+			max_xfer = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			async = true;
+			break;
+		case 'c':
+			mount_opts.cache_blocks = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'C':
+			mount_opts.cache_bytes = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'D':
+			mount_opts.delalloc_bytes = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'P':
+			prealloc = true;
+			break;
+		case 'S': {
+			char *end;
+			stream_bytes = (uint32_t)strtoul(optarg, &end, 0);
+			if (*end == ':')
+				stream_ms = (uint32_t)strtoul(end + 1, NULL, 0);
+			break;
+		}
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind >= argc || partition < 0 || partition > 4 ||
+	    !buf_size || !rec_size || rec_size > buf_size) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	image = argv[optind];
+
+	buf = malloc(buf_size);
+	if (!buf)
+		return EXIT_FAILURE;
+
+	file_dev_name_set(image);
+	file_dev_latency_set(latency_us);
+	file_dev_max_xfer_set(max_xfer);
+	file_dev_async_set(async);
+	bd = file_dev_get();
+
+	printf("image %s, file %" PRIu32 " MB, buffer %zu, record %zu, "
+	       "files %" PRIu32 ", latency %" PRIu32 " us%s\n",
+	       image, file_size_mb, buf_size, rec_size, file_count, latency_us,
+	       async ? ", async" : "");
+
+	r = bench_mount();
+	if (r != EOK)
+		return EXIT_FAILURE;
+
+	r = bench_sequential();
+	if (r == EOK)
+		r = bench_records();
+	if (r == EOK)
+		r = bench_prealloc_free();
+	if (r == EOK)
+		r = bench_metadata();
+
+	if (bench_umount() != EOK)
+		r = EIO;
+
+	free(buf);
+	return r == EOK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
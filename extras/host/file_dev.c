@@ -0,0 +1,344 @@
+/* file_dev.c - Host (Linux) file backed block device for lwext4.
+ * Copyright (c) 2022-2024, Warren Watson.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice, development funding notice, and this permission
+ * notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// Stand-in for the USB MSD glue in GIGAext4FS.cpp so the lwext4 core can be
+// built, profiled and benchmarked on a PC against images made by mke2fs.
+#define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE
+
+#include "file_dev.h"
+#include "ext4/ext4_errno.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+//**********************BLOCKDEV INTERFACE**************************************
+static int file_dev_open(struct ext4_blockdev *bdev);
+static int file_dev_bread(struct ext4_blockdev *bdev, void *buf, uint64_t blk_id,
+			 uint32_t blk_cnt);
+static int file_dev_bwrite(struct ext4_blockdev *bdev, const void *buf,
+			  uint64_t blk_id, uint32_t blk_cnt);
+static int file_dev_close(struct ext4_blockdev *bdev);
+static int file_dev_lock(struct ext4_blockdev *bdev);
+static int file_dev_unlock(struct ext4_blockdev *bdev);
+static int file_dev_submit_read(struct ext4_blockdev *bdev, void *buf,
+				uint64_t blk_id, uint32_t blk_cnt);
+static int file_dev_submit_write(struct ext4_blockdev *bdev, const void *buf,
+				 uint64_t blk_id, uint32_t blk_cnt);
+static int file_dev_wait(struct ext4_blockdev *bdev);
+
+//******************************************************************************
+EXT4_BLOCKDEV_STATIC_INSTANCE(file_dev, FILE_DEV_BLOCK_SIZE, 0, file_dev_open,
+			      file_dev_bread, file_dev_bwrite, file_dev_close,
+			      file_dev_lock, file_dev_unlock);
+
+static const char *fname = "ext4.img";
+static int dev_fd = -1;
+static uint32_t dev_latency_us;
+static uint32_t dev_max_xfer;
+static pthread_mutex_t dev_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Asynchronous mode: a worker thread runs submitted requests in order.
+#define FILE_DEV_QUEUE_LEN 8
+
+struct file_dev_req {
+	uint8_t *buf;
+	uint64_t blk_id;
+	uint32_t blk_cnt;
+	bool wr;
+	bool done;
+	int res;
+};
+
+static struct file_dev_req dev_queue[FILE_DEV_QUEUE_LEN];
+static uint32_t q_head;  // Oldest request not waited for.
+static uint32_t q_next;  // Next request for the worker.
+static uint32_t q_tail;  // Next free slot.
+static bool q_stop;
+static bool dev_async;
+static pthread_t q_worker;
+static pthread_mutex_t q_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t q_cond = PTHREAD_COND_INITIALIZER;
+
+static int file_dev_xfer(struct ext4_blockdev *bdev, uint8_t *p,
+			 uint64_t blk_id, uint32_t blk_cnt, bool wr);
+static void *file_dev_worker(void *arg);
+
+//******************************************************************************
+// Emulated per-command latency (see file_dev_latency_set()).
+//******************************************************************************
+static void file_dev_delay(void)
+{
+	struct timespec ts;
+
+	if (!dev_latency_us)
+		return;
+	ts.tv_sec = dev_latency_us / 1000000;
+	ts.tv_nsec = (long)(dev_latency_us % 1000000) * 1000;
+	while (nanosleep(&ts, &ts) != 0)
+		;
+}
+
+//******************************************************************************
+// Open image. Size of the image is the size of the device. MBR partitions
+// share this interface, so only the parent device geometry is set here.
+//******************************************************************************
+static int file_dev_open(struct ext4_blockdev *bdev)
+{
+	off_t size;
+
+	(void)bdev;
+	dev_fd = open(fname, O_RDWR);
+	if (dev_fd < 0)
+		return EIO;
+
+	// Works for regular files and block device nodes alike.
+	size = lseek(dev_fd, 0, SEEK_END);
+	if (size < 0)
+		goto Fail;
+
+	file_dev.part_offset = 0;
+	file_dev.part_size = (uint64_t)size;
+	file_dev.bdif->ph_bcnt = (uint64_t)size / file_dev.bdif->ph_bsize;
+
+	if (dev_async) {
+		q_head = q_next = q_tail = 0;
+		q_stop = false;
+		if (pthread_create(&q_worker, NULL, file_dev_worker, bdev))
+			goto Fail;
+	}
+	return EOK;
+
+Fail:
+	close(dev_fd);
+	dev_fd = -1;
+	return EIO;
+}
+
+//******************************************************************************
+// One emulated device command. Sleeps once, then moves len bytes.
+//******************************************************************************
+static int file_dev_cmd(uint8_t *p, size_t len, off_t off, bool wr)
+{
+	file_dev_delay();
+	while (len) {
+		ssize_t n = wr ? pwrite(dev_fd, p, len, off) :
+				 pread(dev_fd, p, len, off);
+		if (n <= 0)
+			return EIO;
+		p += n;
+		off += n;
+		len -= (size_t)n;
+	}
+	return EOK;
+}
+
+//******************************************************************************
+// Split a request into commands of at most dev_max_xfer sectors, like the
+// USB glue does.
+//******************************************************************************
+static int file_dev_xfer(struct ext4_blockdev *bdev, uint8_t *p,
+			 uint64_t blk_id, uint32_t blk_cnt, bool wr)
+{
+	uint32_t bsize = bdev->bdif->ph_bsize;
+
+	while (blk_cnt) {
+		uint32_t n = blk_cnt;
+		if (dev_max_xfer && n > dev_max_xfer)
+			n = dev_max_xfer;
+		if (file_dev_cmd(p, (size_t)n * bsize,
+				 (off_t)(blk_id * bsize), wr) != EOK)
+			return EIO;
+		p += (size_t)n * bsize;
+		blk_id += n;
+		blk_cnt -= n;
+	}
+	return EOK;
+}
+
+//******************************************************************************
+// Low level block (sector) read.
+//******************************************************************************
+static int file_dev_bread(struct ext4_blockdev *bdev, void *buf, uint64_t blk_id,
+			 uint32_t blk_cnt)
+{
+	return file_dev_xfer(bdev, buf, blk_id, blk_cnt, false);
+}
+
+//******************************************************************************
+// Low level block (sector) write.
+//******************************************************************************
+static int file_dev_bwrite(struct ext4_blockdev *bdev, const void *buf,
+			  uint64_t blk_id, uint32_t blk_cnt)
+{
+	return file_dev_xfer(bdev, (uint8_t *)buf, blk_id, blk_cnt, true);
+}
+
+//******************************************************************************
+// Worker thread of the asynchronous mode.
+//******************************************************************************
+static void *file_dev_worker(void *arg)
+{
+	struct ext4_blockdev *bdev = arg;
+	struct file_dev_req *req;
+
+	pthread_mutex_lock(&q_mutex);
+	for (;;) {
+		while (q_next == q_tail && !q_stop)
+			pthread_cond_wait(&q_cond, &q_mutex);
+		if (q_next == q_tail)
+			break;
+
+		req = &dev_queue[q_next % FILE_DEV_QUEUE_LEN];
+		pthread_mutex_unlock(&q_mutex);
+		req->res = file_dev_xfer(bdev, req->buf, req->blk_id,
+					 req->blk_cnt, req->wr);
+		pthread_mutex_lock(&q_mutex);
+		req->done = true;
+		q_next++;
+		pthread_cond_broadcast(&q_cond);
+	}
+	pthread_mutex_unlock(&q_mutex);
+	return NULL;
+}
+
+static int file_dev_submit(uint8_t *buf, uint64_t blk_id, uint32_t blk_cnt,
+			   bool wr)
+{
+	struct file_dev_req *req;
+
+	pthread_mutex_lock(&q_mutex);
+	if (q_tail - q_head == FILE_DEV_QUEUE_LEN) {
+		pthread_mutex_unlock(&q_mutex);
+		return EBUSY;
+	}
+	req = &dev_queue[q_tail % FILE_DEV_QUEUE_LEN];
+	req->buf = buf;
+	req->blk_id = blk_id;
+	req->blk_cnt = blk_cnt;
+	req->wr = wr;
+	req->done = false;
+	q_tail++;
+	pthread_cond_broadcast(&q_cond);
+	pthread_mutex_unlock(&q_mutex);
+	return EOK;
+}
+
+static int file_dev_submit_read(struct ext4_blockdev *bdev, void *buf,
+				uint64_t blk_id, uint32_t blk_cnt)
+{
+	(void)bdev;
+	return file_dev_submit(buf, blk_id, blk_cnt, false);
+}
+
+static int file_dev_submit_write(struct ext4_blockdev *bdev, const void *buf,
+				 uint64_t blk_id, uint32_t blk_cnt)
+{
+	(void)bdev;
+	return file_dev_submit((uint8_t *)buf, blk_id, blk_cnt, true);
+}
+
+static int file_dev_wait(struct ext4_blockdev *bdev)
+{
+	struct file_dev_req *req;
+	int r;
+
+	(void)bdev;
+	pthread_mutex_lock(&q_mutex);
+	if (q_head == q_tail) {
+		pthread_mutex_unlock(&q_mutex);
+		return EINVAL;
+	}
+	req = &dev_queue[q_head % FILE_DEV_QUEUE_LEN];
+	while (!req->done)
+		pthread_cond_wait(&q_cond, &q_mutex);
+	r = req->res;
+	q_head++;
+	pthread_mutex_unlock(&q_mutex);
+	return r;
+}
+
+//******************************************************************************
+// Close image.
+//******************************************************************************
+static int file_dev_close(struct ext4_blockdev *bdev)
+{
+	(void)bdev;
+	if (dev_fd < 0)
+		return EOK;
+	if (dev_async) {
+		pthread_mutex_lock(&q_mutex);
+		q_stop = true;
+		pthread_cond_broadcast(&q_cond);
+		pthread_mutex_unlock(&q_mutex);
+		pthread_join(q_worker, NULL);
+	}
+	fsync(dev_fd);
+	close(dev_fd);
+	dev_fd = -1;
+	return EOK;
+}
+
+static int file_dev_lock(struct ext4_blockdev *bdev)
+{
+	(void)bdev;
+	return pthread_mutex_lock(&dev_mutex) ? EIO : EOK;
+}
+
+static int file_dev_unlock(struct ext4_blockdev *bdev)
+{
+	(void)bdev;
+	return pthread_mutex_unlock(&dev_mutex) ? EIO : EOK;
+}
+
+//******************************************************************************
+
+void file_dev_name_set(const char *n)
+{
+	fname = n;
+}
+
+void file_dev_latency_set(uint32_t usec)
+{
+	dev_latency_us = usec;
+}
+
+void file_dev_async_set(bool on)
+{
+	dev_async = on;
+	file_dev.bdif->submit_read = on ? file_dev_submit_read : NULL;
+	file_dev.bdif->submit_write = on ? file_dev_submit_write : NULL;
+	file_dev.bdif->wait = on ? file_dev_wait : NULL;
+}
+
+void file_dev_max_xfer_set(uint32_t blocks)
+{
+	dev_max_xfer = blocks;
+}
+
+struct ext4_blockdev *file_dev_get(void)
+{
+	return &file_dev;
+}
@@ -0,0 +1,68 @@
+/* file_dev.h - Host (Linux) file backed block device for lwext4.
+ * Copyright (c) 2022-2024, Warren Watson.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice, development funding notice, and this permission
+ * notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FILE_DEV_H_
+#define FILE_DEV_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "ext4/ext4_config.h"
+#include "ext4/ext4_blockdev.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Physical sector size of the image. Same as the GIGA USB glue.
+#define FILE_DEV_BLOCK_SIZE 512
+
+/**@brief   Set the raw disk image (or block device node) to open.
+ * @param   fname image path*/
+void file_dev_name_set(const char *fname);
+
+/**@brief   Emulate a fixed per-command device latency. Every bread/bwrite
+ *          call sleeps this long before touching the image, which makes
+ *          command counts show up in host timings the way they do on USB.
+ * @param   usec latency in microseconds (0 = off)*/
+void file_dev_latency_set(uint32_t usec);
+
+/**@brief   Split requests into commands of at most this many sectors,
+ *          the way the USB glue does (EXT4_MAX_XFER_BLOCKS on the GIGA).
+ *          Each command pays the emulated latency.
+ * @param   blocks max sectors per command (0 = no limit)*/
+void file_dev_max_xfer_set(uint32_t blocks);
+
+/**@brief   Install the submit_read/submit_write/wait hooks. Requests are
+ *          then run by a worker thread. Call before the device is opened.
+ * @param   on true - asynchronous, false - bread/bwrite only*/
+void file_dev_async_set(bool on);
+
+/**@brief   Get the file block device.
+ * @return  block device handle*/
+struct ext4_blockdev *file_dev_get(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FILE_DEV_H_ */
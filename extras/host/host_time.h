@@ -0,0 +1,42 @@
+/* host_time.h - Host (Linux) time stamp for the lwext4 I/O statistics.
+ * Copyright (c) 2022-2024, Warren Watson.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice, development funding notice, and this permission
+ * notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// Force included into the host build of the lwext4 core (see CMakeLists.txt)
+// so the device time statistics use the monotonic clock instead of micros().
+
+#ifndef HOST_TIME_H_
+#define HOST_TIME_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/* Truncated to 32 bit so it wraps like micros() on the board */
+static inline uint32_t ext4_host_time_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000000u +
+			  (uint64_t)ts.tv_nsec / 1000u);
+}
+
+#define CONFIG_BLOCK_DEV_TIME_US() ext4_host_time_us()
+
+#endif /* HOST_TIME_H_ */
@@ -462,6 +462,85 @@ int EXT4FileSystem::stat(const char *path, struct stat *st)
     return 0;
 }
 
+int EXT4FileSystem::fallocate(const char *path, off_t offset, off_t len,
+                              bool keep_size)
+{
+    Deferred<const char *> fpath = ext_path_prefix(_id, path);
+    ext4_file fh;
+
+    if (offset < 0 || len <= 0) {
+        return -EINVAL;
+    }
+
+    lock();
+    int res = ext4_fopen(&fh, fpath, "a");
+    if (res == EOK) {
+        res = ext4_fallocate(&fh, offset, len,
+                             keep_size ? EXT4_FALLOC_KEEP_SIZE : 0);
+        int cres = ext4_fclose(&fh);
+        if (res == EOK) {
+            res = cres;
+        }
+    }
+    unlock();
+
+    if (res != EOK) {
+        debug_if(FFS_DBG, "ext4_fallocate() failed: %d\n", res);
+        return -res;
+    }
+    return 0;
+}
+
+int EXT4FileSystem::punch(const char *path, off_t offset, off_t len)
+{
+    Deferred<const char *> fpath = ext_path_prefix(_id, path);
+    ext4_file fh;
+
+    if (offset < 0 || len <= 0) {
+        return -EINVAL;
+    }
+
+    lock();
+    int res = ext4_fopen(&fh, fpath, "r+");
+    if (res == EOK) {
+        res = ext4_fpunch(&fh, offset, len);
+        int cres = ext4_fclose(&fh);
+        if (res == EOK) {
+            res = cres;
+        }
+    }
+    unlock();
+
+    if (res != EOK) {
+        debug_if(FFS_DBG, "ext4_fpunch() failed: %d\n", res);
+        return -res;
+    }
+    return 0;
+}
+
+int EXT4FileSystem::file_datasync(fs_file_t file)
+{
+    ext4_file *fh = static_cast<ext4_file *>(file);
+
+    lock();
+    int res = ext4_fdatasync(fh);
+    unlock();
+
+    if (res != EOK) {
+        debug_if(FFS_DBG, "ext4_fdatasync() failed: %d\n", res);
+        return -res;
+    }
+    return 0;
+}
+
+void EXT4FileSystem::append_stream(uint32_t bytes, uint32_t interval_ms)
+{
+    lock();
+    _stream_bytes = bytes;
+    _stream_ms = interval_ms;
+    unlock();
+}
+
 int EXT4FileSystem::statvfs(const char *path, struct statvfs *buf)
 {
 
@@ -540,6 +619,17 @@ int EXT4FileSystem::file_open(fs_file_t *file, const char *path, int flags)
         return res;
     }
 
+    // Data of bulk transfers bypasses the block cache, metadata stays hot.
+    if (flags & O_DIRECT) {
+        fh->flags |= EXT4_O_DIRECT;
+    } else if ((flags & O_APPEND) && _stream_bytes) {
+        // Not fatal, the file is appended to without the buffer.
+        res = ext4_fstream(fh, _stream_bytes, _stream_ms);
+        if (res != EOK) {
+            debug_if(FFS_DBG, "ext4_fstream() failed: %d\n", res);
+        }
+    }
+
     unlock();
 
     *file = fh;
@@ -595,17 +685,17 @@ ssize_t EXT4FileSystem::file_write(fs_file_t file, const void *buffer, size_t le
 
 int EXT4FileSystem::file_sync(fs_file_t file)
 {
-// Not setup yet.
-//    ext4_file *fh = static_cast<ext4_file *>(file);
-printf("file_sync()\n");
+    ext4_file *fh = static_cast<ext4_file *>(file);
+
     lock();
-    int res = EOK; //f_sync(fh);
-//    int res 
+    int res = ext4_fsync(fh);
     unlock();
+
     if (res != EOK) {
-        debug_if(FFS_DBG, "f_sync() failed: %d\n", res);
+        debug_if(FFS_DBG, "ext4_fsync() failed: %d\n", res);
+        return -res;
     }
-    return res;
+    return 0;
 }
 
 off_t EXT4FileSystem::file_seek(fs_file_t file, off_t offset, int whence)
@@ -619,7 +709,7 @@ off_t EXT4FileSystem::file_seek(fs_file_t file, off_t offset, int whence)
 
     if (res != EOK) {
         debug_if(FFS_DBG, "lseek failed: %d\n", res);
-        return res;
+        return -res;  // Must be negative, eg: -ENXIO for SEEK_DATA at EOF.
     } else {
         return noffset;
     }
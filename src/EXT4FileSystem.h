@@ -31,6 +31,12 @@
 
 #define DONT_SHOW_DOT_FILES 1 // Set to one to hide dot files.
 
+// file_open() flag, mapped to EXT4_O_DIRECT. Linux value if the libc
+// has none, sketches see the same one through this header.
+#ifndef O_DIRECT
+#define O_DIRECT 040000
+#endif
+
 namespace mbed {
 
 class EXT4FileSystem : public FileSystem {
@@ -155,6 +161,61 @@ public:
 
     virtual const char *getVolumeLabel(void);
 
+    /** Preallocate space for a file, creating it if needed.
+     *
+     *  Blocks are reserved as unwritten extents, nothing is written to the
+     *  drive. They read back as zeros until written and later writes to
+     *  them do not need the block allocator. eg: preallocate an hourly log
+     *  file with keep_size = true and append to it as usual.
+     *
+     *  @param path      The name of the file.
+     *  @param offset    First byte of the range to preallocate.
+     *  @param len       Length of the range in bytes.
+     *  @param keep_size false - the file grows to offset + len,
+     *                   true - the file size is not changed.
+     *  @return          0 on success, negative error code on failure.
+     */
+    virtual int fallocate(const char *path, off_t offset, off_t len,
+                          bool keep_size = false);
+
+    /** Free the space of a range inside a file and leave a hole.
+     *
+     *  The range reads back as zeros, the file size is not changed. eg:
+     *  drop the oldest hour of a ring buffer log file in place. Use
+     *  lseek() with SEEK_DATA / SEEK_HOLE (3 / 4) to find the holes.
+     *
+     *  @param path      The name of the file.
+     *  @param offset    First byte of the range.
+     *  @param len       Length of the range in bytes.
+     *  @return          0 on success, negative error code on failure.
+     */
+    virtual int punch(const char *path, off_t offset, off_t len);
+
+    /** Write the cached data of an open file to the drive, other files
+     *  stay in the cache.
+     *
+     *  Like file_sync(), but inode changes that do not affect reading
+     *  the data back (mode, owner, times) are not written. Appends held
+     *  by the handle (delayed allocation, append_stream()) are written
+     *  first.
+     *
+     *  @param file      File handle.
+     *  @return          0 on success, negative error code on failure.
+     */
+    virtual int file_datasync(fs_file_t file);
+
+    /** Append stream mode for files opened from now on with O_APPEND
+     *  (fopen "a"/"a+"), eg: sensor logs written by many small fprintf()s.
+     *
+     *  Appends collect in a buffer of each file and cost a memcpy. The
+     *  file gets its blocks and inode update when the buffer fills, and
+     *  is written to the drive every interval_ms (see ext4_fstream()).
+     *
+     *  @param bytes       Buffer size per file, 0 turns the mode off.
+     *  @param interval_ms Write back interval, 0 - only on full buffer.
+     */
+    virtual void append_stream(uint32_t bytes, uint32_t interval_ms = 1000);
+
 protected:
 #if !(DOXYGEN_ONLY)
     /** Open a file on the file system.
@@ -163,6 +224,8 @@ protected:
      *  @param path     The name of the file to open.
      *  @param flags    The flags that trigger opening of the file. These flags are O_RDONLY, O_WRONLY, and O_RDWR,
      *                  with an O_CREAT, O_TRUNC, or O_APPEND bitwise OR operator.
+     *                  O_DIRECT keeps the file data out of the block cache
+     *                  (see ext4_fopen2()).
      *  @return         0 on success, negative error code on failure.
      */
     virtual int file_open(fs_file_t *file, const char *path, int flags);
@@ -193,6 +256,9 @@ protected:
     virtual ssize_t file_write(fs_file_t file, const void *buffer, size_t len);
 
     /** Flush any buffers associated with the file.
+     *
+     *  Writes the dirty blocks of this file only: data, extent blocks,
+     *  inode and the bitmaps and group descriptors it changed.
      *
      *  @param file     File handle.
      *  @return         0 on success, negative error code on failure.
@@ -295,6 +361,8 @@ private:
     int _id; // Partition ID
 	struct ext4_mount_stats stats;
     uint8_t partition_type = 0;
+    uint32_t _stream_bytes = 0; // append_stream() settings.
+    uint32_t _stream_ms = 0;
 };
 
 //using mbed::EXT4FileSystem;
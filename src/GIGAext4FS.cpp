@@ -189,6 +189,32 @@ static int ext4_bd_open(struct ext4_blockdev *bdev) {
     return EOK;
 }
 
+//******************************************************************************
+// Split a transfer into USB MSD commands of at most max_xfer sectors.
+// dataTransfer() only takes an 8 bit sector count and a 32 bit LBA, larger
+// requests used to be silently truncated. xfer_done counts the sectors that
+// made it, so a failed request can be told apart from a partial one.
+//******************************************************************************
+static int ext4_bd_xfer(block_device_t *bd, uint8_t *buf, uint64_t blk_id,
+                        uint32_t blk_cnt, int dir) {
+	uint32_t max = bd->max_xfer;
+	uint32_t bsize = bd->pbdev->bdif->ph_bsize;
+
+	bd->xfer_done = 0;
+	if(blk_id + blk_cnt > 0x100000000ULL) return EIO; // READ(10)/WRITE(10) limit.
+	if(!max || max > EXT4_MAX_XFER_BLOCKS) max = EXT4_MAX_XFER_BLOCKS;
+	while(blk_cnt) {
+		uint32_t n = blk_cnt < max ? blk_cnt : max;
+		if(bd->pDrive->dataTransfer(buf, (uint32_t)blk_id, (uint8_t)n, dir) != 0)
+			return EIO;
+		buf += n * bsize;
+		blk_id += n;
+		blk_cnt -= n;
+		bd->xfer_done += n;
+	}
+	return EOK;
+}
+
 //******************************************************************************
 // Low level block (sector) read.
 //******************************************************************************
@@ -208,7 +234,7 @@ static int ext4_bd_bread(struct ext4_blockdev *bdev, void *buf, uint64_t blk_id,
 	if(index <= 2) {
 		if(!bd_list[index].pDrive) return EIO;
         // Added below to do multi block transfers. One mod made to USBHostMSD.h as well.
-        status = bd_list[index].pDrive->dataTransfer((uint8_t *)buf, blk_id, (uint8_t)blk_cnt,USB_DEVICE_TO_HOST);
+        status = ext4_bd_xfer(&bd_list[index], (uint8_t *)buf, blk_id, blk_cnt, USB_DEVICE_TO_HOST);
     //*****************************************************************************************************************************
     // This is the original xfer one block at a time call. 
     // status = bd_list[index].pDrive->read(buf, (uint64_t)(blk_id * bdev->bdif->ph_bsize), (uint64_t)(blk_cnt * bdev->bdif->ph_bsize));
@@ -237,7 +263,7 @@ static int ext4_bd_bwrite(struct ext4_blockdev *bdev, const void *buf,
 #endif
 
 	int index;
-	uint8_t status = 0;
+	int status = 0;
 
 	index = get_bdev(bdev);
 	if(index == -1)
@@ -245,7 +271,7 @@ static int ext4_bd_bwrite(struct ext4_blockdev *bdev, const void *buf,
 	if(index <= 2) {
 		if(!bd_list[index].pDrive) return EIO;
         // Added below to do multi block transfers. One mod made to USBHostMSD.h as well.
-        status = bd_list[index].pDrive->dataTransfer((uint8_t *)buf, blk_id, (uint8_t)blk_cnt,USB_HOST_TO_DEVICE);
+        status = ext4_bd_xfer(&bd_list[index], (uint8_t *)buf, blk_id, blk_cnt, USB_HOST_TO_DEVICE);
     //*****************************************************************************************************************************
     // This is the original xfer one block at a time call. 
     // status = bd_list[index].pDrive->program(buf, (uint64_t)(blk_id * bdev->bdif->ph_bsize), (uint64_t)(blk_cnt * bdev->bdif->ph_bsize));
@@ -404,6 +430,18 @@ bool GIGAext4::clr_BDL_entry(uint8_t dev) {
 	bd_list[dev].pbdev = NULL;
 	bd_list[dev].pDrive = NULL;
 	bd_list[dev].dev_id = -1;
+	bd_list[dev].xfer_done = 0;
+	return true;
+}
+
+//******************************************************************************
+// Limit the number of sectors sent in one USB command (1..255). Some sticks
+// only handle smaller transfers reliably. Returns false on a bad device.
+//******************************************************************************
+bool GIGAext4::setMaxTransfer(uint8_t dev, uint32_t blocks) {
+	if(dev > (CONFIG_EXT4_BLOCKDEVS_COUNT - 1)) return false;
+	if(!blocks || blocks > EXT4_MAX_XFER_BLOCKS) blocks = EXT4_MAX_XFER_BLOCKS;
+	bd_list[dev].max_xfer = blocks;
 	return true;
 }
 
@@ -540,10 +578,60 @@ int GIGAext4::getMountStats(const char *vol, struct ext4_mount_stats *mpInfo) {
 	return ext4_mount_point_stats(vol, mpInfo);
 }
 
+//******************************************************************************
+// Block cache size, blocks in use and most blocks ever in use of a mounted
+// partition. max_ref_blocks close to cache_blocks means the cache is too small.
+//******************************************************************************
+int GIGAext4::getCacheInfo(const char *vol, struct ext4_cache_info *info) {
+	return ext4_mount_point_cache_info(vol, info);
+}
+
+//******************************************************************************
+// Block cache hits/misses, evictions, write back sizes and USB transfer
+// counts, bytes and times (micros()) of a mounted partition since it was
+// mounted or resetIOStats() was called.
+//******************************************************************************
+int GIGAext4::getIOStats(const char *vol, struct ext4_io_stats *stats) {
+	return ext4_mount_point_io_stats(vol, stats);
+}
+
+//******************************************************************************
+// Clear the I/O statistics of a mounted partition. eg: before a benchmark.
+//******************************************************************************
+int GIGAext4::resetIOStats(const char *vol) {
+	return ext4_mount_point_io_stats_reset(vol);
+}
+
+//******************************************************************************
+// Set the block cache size used by the next mount of partition dev (0-3).
+// cache_blocks buffers, or as many as fit in cache_bytes if cache_blocks is 0.
+// Both 0 selects CONFIG_BLOCK_DEV_CACHE_SIZE. eg: setMountOpts(0, 256);
+//******************************************************************************
+bool GIGAext4::setMountOpts(uint8_t dev, uint32_t cache_blocks, uint32_t cache_bytes) {
+	if(dev >= MAX_MOUNT_POINTS) return false;
+	mount_list[dev].opts.cache_blocks = cache_blocks;
+	mount_list[dev].opts.cache_bytes = cache_bytes;
+	return true;
+}
+
+//******************************************************************************
+// Delayed allocation for the next mount of partition dev (0-3). Appends to each
+// open file are held in a buffer of bytes (malloc'ed on the first append) and
+// get their blocks in one contiguous run when it fills or the file is closed.
+// 0 turns it off. eg: setDelalloc(0, 32768); Data in the buffer is lost if
+// the drive is pulled before the file is closed.
+//******************************************************************************
+bool GIGAext4::setDelalloc(uint8_t dev, uint32_t bytes) {
+	if(dev >= MAX_MOUNT_POINTS) return false;
+	mount_list[dev].opts.delalloc_bytes = bytes;
+	return true;
+}
+
 //******************************************************************************
 // Mount a partition. Called by begin or external call. Recovers file system errors.
+// opts overrides the options set with setMountOpts() (NULL = use those).
 //******************************************************************************
-int GIGAext4::lwext_mount(uint8_t dev) {
+int GIGAext4::lwext_mount(uint8_t dev, const struct ext4_mount_opts *opts) {
 #ifdef EXT4_DBG
   printf("lwext_mount(%d)\n",dev);
 #endif
@@ -555,7 +643,8 @@ int GIGAext4::lwext_mount(uint8_t dev) {
 		printf("ext4_device_register: rc = %d\n", r);
 		return r;
 	}
-	r = ext4_mount(mount_list[dev].pname, mount_list[dev].pname, false);
+	if(!opts) opts = &mount_list[dev].opts;
+	r = ext4_mount_ex(mount_list[dev].pname, mount_list[dev].pname, opts);
 	if (r != EOK) {
 		printf("ext4_mount: rc = %d\n", r);
 		(void)ext4_device_unregister(mount_list[dev].pname);
@@ -48,6 +48,10 @@
 
 #define EXT4_BLOCK_SIZE 512
 
+// USBHostMSD::dataTransfer() takes an 8 bit sector count. Bigger requests
+// are split into commands of at most this many sectors (see setMaxTransfer()).
+#define EXT4_MAX_XFER_BLOCKS 255
+
 enum {USB_TYPE=0, SD_TYPE=CONFIG_EXT4_BLOCKDEVS_COUNT-1}; // what type of block device
 
 /* controls for block devices */
@@ -86,6 +90,8 @@ typedef struct block_device {
 	USBHostMSD *pDrive;
 	struct ext4_blockdev *pbdev; // &_ext4_bd ...&_ext4_bd3
 	bool connected = false;
+	uint32_t max_xfer = EXT4_MAX_XFER_BLOCKS; // Max sectors per USB command.
+	uint32_t xfer_done = 0; // Sectors moved by last read/write (also on error).
 }block_device_t;
 
 //  Mount Point Info.
@@ -97,6 +103,7 @@ typedef struct bd_mounts {
     uint8_t pt = 0;
 	block_device_t parent_bd;
 	bool mounted = false;
+	struct ext4_mount_opts opts = {}; // Cache size etc. (see setMountOpts()).
 }bd_mounts_t;
 
 static block_device_t bd_list[CONFIG_EXT4_BLOCKDEVS_COUNT];
@@ -141,12 +148,18 @@ public:
 	virtual int scan_mbr(uint8_t dev);
 	virtual int mount(uint8_t device);
 	virtual int umountFS(const char *device);
-	virtual int lwext_mount(uint8_t dev);
+	virtual int lwext_mount(uint8_t dev, const struct ext4_mount_opts *opts = NULL);
+	virtual bool setMountOpts(uint8_t dev, uint32_t cache_blocks, uint32_t cache_bytes = 0);
+	virtual bool setDelalloc(uint8_t dev, uint32_t bytes);
 	virtual int lwext_umount(uint8_t dev);
 	virtual int getMountStats(const char * vol, struct ext4_mount_stats *mpInfo);
+	virtual int getCacheInfo(const char * vol, struct ext4_cache_info *info);
+	virtual int getIOStats(const char * vol, struct ext4_io_stats *stats);
+	virtual int resetIOStats(const char * vol);
 	virtual int lwext_mkfs (struct ext4_blockdev *bdev, const char *label = "");
 	virtual const char *get_mp_name(uint8_t id);
 	virtual block_device_t *get_bd_list(void);
+	virtual bool setMaxTransfer(uint8_t dev, uint32_t blocks);
 	virtual bd_mounts_t *get_mount_list(void);
 	virtual int lwext_stat(const char *filename, stat_t *buf);
 	virtual const char * getVolumeLabel();
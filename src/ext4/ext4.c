@@ -52,6 +52,7 @@
 #include "ext4_dir_idx.h"
 #include "ext4_xattr.h"
 #include "ext4_journal.h"
+#include "ext4_dcache.h"
 
 
 #include <stdlib.h>
@@ -71,6 +72,9 @@
 			(_m)->os_locks->unlock();                              \
 	} while (0)
 
+/**@brief   Smallest block cache a mount option can ask for*/
+#define EXT4_MOUNT_CACHE_MIN 8
+
 /**@brief   Mount point descriptor.*/
 struct ext4_mountpoint {
 
@@ -94,6 +98,13 @@ struct ext4_mountpoint {
 
 	/**@brief   Block cache.*/
 	struct ext4_bcache bc;
+
+	/**@brief   Delayed allocation buffer size of open files
+	 *          (@ref ext4_mount_opts).*/
+	uint32_t delalloc_bytes;
+
+	/**@brief   Directory entry cache.*/
+	struct ext4_dcache dc;
 };
 
 /**@brief   Block devices descriptor.*/
@@ -219,6 +230,9 @@ static int ext4_link(struct ext4_mountpoint *mp, struct ext4_inode_ref *parent,
 	if (len > EXT4_DIRECTORY_FILENAME_LEN)
 		return EINVAL;
 
+	/* Drop a cached negative entry of the name */
+	ext4_dcache_remove(&mp->dc, parent->index, n, len);
+
 	/* Add entry to parent directory */
 	int r = ext4_dir_add_entry(parent, n, len, ch);
 	if (r != EOK)
@@ -326,6 +340,10 @@ static int ext4_unlink(struct ext4_mountpoint *mp,
 	bool is_dir = ext4_inode_is_type(&mp->fs.sb, child->inode,
 					 EXT4_INODE_MODE_DIRECTORY);
 
+	ext4_dcache_remove(&mp->dc, parent->index, name, name_len);
+	if (is_dir)
+		ext4_dcache_purge_dir(&mp->dc, child->index);
+
 	/* If directory - handle links from parent */
 	if (is_dir) {
 		ext4_fs_inode_links_count_dec(parent);
@@ -357,16 +375,45 @@ static int ext4_unlink(struct ext4_mountpoint *mp,
 
 /****************************************************************************/
 
+/**@brief   Block cache entries for given mount options.*/
+static uint32_t ext4_mount_cache_blocks(const struct ext4_mount_opts *opts,
+					uint32_t bsize)
+{
+	uint32_t cnt = CONFIG_BLOCK_DEV_CACHE_SIZE;
+
+	if (opts->cache_blocks)
+		cnt = opts->cache_blocks;
+	else if (opts->cache_bytes)
+		cnt = opts->cache_bytes / (bsize + sizeof(struct ext4_buf));
+
+	/*A few blocks are referenced at the same time by most operations*/
+	return cnt < EXT4_MOUNT_CACHE_MIN ? EXT4_MOUNT_CACHE_MIN : cnt;
+}
+
 int ext4_mount(const char *dev_name, const char *mount_point,
 	       bool read_only)
+{
+	struct ext4_mount_opts opts = {
+		.read_only = read_only,
+	};
+
+	return ext4_mount_ex(dev_name, mount_point, &opts);
+}
+
+int ext4_mount_ex(const char *dev_name, const char *mount_point,
+		  const struct ext4_mount_opts *opts)
 {
 	int r;
 	uint32_t bsize;
+	struct ext4_mount_opts def_opts = {0};
 	struct ext4_bcache *bc;
 	struct ext4_blockdev *bd = 0;
 	struct ext4_mountpoint *mp = 0;
 	ext4_assert(mount_point && dev_name);
 
+	if (!opts)
+		opts = &def_opts;
+
 	size_t mp_len = strlen(mount_point);
 
 	if (mp_len > CONFIG_EXT4_MAX_MP_NAME)
@@ -403,7 +450,9 @@ int ext4_mount(const char *dev_name, const char *mount_point,
 	if (r != EOK)
 		return r;
 
-	r = ext4_fs_init(&mp->fs, bd, read_only);
+	memset(&bd->stats, 0, sizeof(bd->stats));
+
+	r = ext4_fs_init(&mp->fs, bd, opts->read_only);
 	if (r != EOK) {
 		ext4_block_fini(bd);
 		return r;
@@ -413,8 +462,10 @@ int ext4_mount(const char *dev_name, const char *mount_point,
 	ext4_block_set_lb_size(bd, bsize);
 	bc = &mp->bc;
 
-	r = ext4_bcache_init_dynamic(bc, CONFIG_BLOCK_DEV_CACHE_SIZE, bsize);
+	r = ext4_bcache_init_dynamic(bc, ext4_mount_cache_blocks(opts, bsize),
+				     bsize);
 	if (r != EOK) {
+		mp->mounted = 0;
 		ext4_block_fini(bd);
 		return r;
 	}
@@ -432,6 +483,8 @@ int ext4_mount(const char *dev_name, const char *mount_point,
 	}
 
 	bd->fs = &mp->fs;
+	mp->delalloc_bytes = opts->read_only ? 0 : opts->delalloc_bytes;
+	ext4_dcache_init(&mp->dc);
 	return r;
 }
 
@@ -577,6 +630,8 @@ static int __ext4_recover(const char *mount_point)
 		r = jbd_recover(jbd_fs);
 		jbd_put_fs(jbd_fs);
 		ext4_free(jbd_fs);
+		ext4_fs_bgd_drop(&mp->fs);
+		ext4_dcache_init(&mp->dc);
 	}
 	if (r == EOK && !mp->fs.read_only) {
 		uint32_t bgid;
@@ -645,6 +700,8 @@ static int __ext4_trans_stop(struct ext4_mountpoint *mp)
 
 static void __ext4_trans_abort(struct ext4_mountpoint *mp)
 {
+	/*Names cached during the transaction may be rolled back*/
+	ext4_dcache_init(&mp->dc);
 	if (mp->fs.jbd_journal && mp->fs.curr_trans) {
 		struct jbd_journal *journal = mp->fs.jbd_journal;
 		struct jbd_trans *trans = mp->fs.curr_trans;
@@ -731,6 +788,53 @@ int ext4_mount_point_stats(const char *mount_point,
 	return EOK;
 }
 
+int ext4_mount_point_cache_info(const char *mount_point,
+				struct ext4_cache_info *info)
+{
+	struct ext4_mountpoint *mp = ext4_get_mount(mount_point);
+
+	if (!mp)
+		return ENOENT;
+
+	EXT4_MP_LOCK(mp);
+	info->block_size = mp->bc.itemsize;
+	info->cache_blocks = mp->bc.cnt;
+	info->ref_blocks = mp->bc.ref_blocks;
+	info->max_ref_blocks = mp->bc.max_ref_blocks;
+	EXT4_MP_UNLOCK(mp);
+
+	return EOK;
+}
+
+int ext4_mount_point_io_stats(const char *mount_point,
+			      struct ext4_io_stats *stats)
+{
+	struct ext4_mountpoint *mp = ext4_get_mount(mount_point);
+
+	if (!mp)
+		return ENOENT;
+
+	EXT4_MP_LOCK(mp);
+	*stats = mp->fs.bdev->stats;
+	EXT4_MP_UNLOCK(mp);
+
+	return EOK;
+}
+
+int ext4_mount_point_io_stats_reset(const char *mount_point)
+{
+	struct ext4_mountpoint *mp = ext4_get_mount(mount_point);
+
+	if (!mp)
+		return ENOENT;
+
+	EXT4_MP_LOCK(mp);
+	memset(&mp->fs.bdev->stats, 0, sizeof(mp->fs.bdev->stats));
+	EXT4_MP_UNLOCK(mp);
+
+	return EOK;
+}
+
 int ext4_mount_setup_locks(const char *mount_point,
 			   const struct ext4_lock *locks)
 {
@@ -853,7 +957,8 @@ static int ext4_trunc_inode(struct ext4_mountpoint *mp,
 			ext4_trans_stop(mp);
 	}
 
-	if (inode_size > new_size) {
+	/* Also at the same size, for blocks preallocated past the end */
+	if (inode_size >= new_size) {
 
 		inode_size = new_size;
 
@@ -917,6 +1022,67 @@ static int ext4_trunc_dir(struct ext4_mountpoint *mp,
 	return ext4_fs_truncate_inode(dir, 0);
 }
 
+static int ext4_fdelalloc_flush(ext4_file *file);
+
+/**@brief   Forget the block mappings cached in a file descriptor.*/
+static void ext4_file_map_reset(ext4_file *f)
+{
+#if CONFIG_EXT4_FILE_MAP_CACHE
+	memset(f->map, 0, sizeof(f->map));
+	f->map_next = 0;
+	f->map_gen = f->mp->fs.map_gen;
+#else
+	(void)f;
+#endif
+}
+
+/**@brief   Look a name up in a directory, through the dentry cache.
+ * @return  EOK, ENOENT (also answered from the cache) or error code*/
+static int ext4_dir_lookup(struct ext4_mountpoint *mp,
+			   struct ext4_inode_ref *dir, const char *name,
+			   uint32_t len, uint32_t *inode, uint32_t *imode)
+{
+	struct ext4_sblock *const sb = &mp->fs.sb;
+	struct ext4_dir_search_result result;
+	int r;
+
+	if (ext4_dcache_lookup(&mp->dc, dir->index, name, len, inode, imode))
+		return *inode ? EOK : ENOENT;
+
+	r = ext4_dir_find_entry(&result, dir, name, len);
+	if (r != EOK) {
+		/*Destroy last result*/
+		ext4_dir_destroy_result(dir, &result);
+		if (r == ENOENT)
+			ext4_dcache_insert(&mp->dc, dir->index, name, len, 0, 0);
+		return r;
+	}
+
+	*inode = ext4_dir_en_get_inode(result.dentry);
+	if (ext4_sb_feature_incom(sb, EXT4_FINCOM_FILETYPE)) {
+		uint8_t t;
+		t = ext4_dir_en_get_inode_type(sb, result.dentry);
+		*imode = ext4_fs_correspond_inode_mode(t);
+	} else {
+		struct ext4_inode_ref child_ref;
+		r = ext4_fs_get_inode_ref(&mp->fs, *inode, &child_ref);
+		if (r != EOK) {
+			ext4_dir_destroy_result(dir, &result);
+			return r;
+		}
+
+		*imode = ext4_inode_type(sb, child_ref.inode);
+		ext4_fs_put_inode_ref(&child_ref);
+	}
+
+	r = ext4_dir_destroy_result(dir, &result);
+	if (r != EOK)
+		return r;
+
+	ext4_dcache_insert(&mp->dc, dir->index, name, len, *inode, *imode);
+	return EOK;
+}
+
 /*
  * NOTICE: if filetype is equal to EXT4_DIRENTRY_UNKNOWN,
  * any filetype of the target dir entry will be accepted.
@@ -932,7 +1098,6 @@ static int ext4_generic_open2(ext4_file *f, const char *path, int flags,
 	int r;
 	int len;
 	struct ext4_mountpoint *mp = ext4_get_mount(path);
-	struct ext4_dir_search_result result;
 	struct ext4_inode_ref ref;
 
 	f->mp = 0;
@@ -976,11 +1141,8 @@ static int ext4_generic_open2(ext4_file *f, const char *path, int flags,
 			r = ENOENT;
 			break;
 		}
-		r = ext4_dir_find_entry(&result, &ref, path, len);
+		r = ext4_dir_lookup(mp, &ref, path, len, &next_inode, &imode);
 		if (r != EOK) {
-
-			/*Destroy last result*/
-			ext4_dir_destroy_result(&ref, &result);
 			if (r != ENOENT)
 				break;
 
@@ -1016,25 +1178,6 @@ static int ext4_generic_open2(ext4_file *f, const char *path, int flags,
 		if (parent_inode)
 			*parent_inode = ref.index;
 
-		next_inode = ext4_dir_en_get_inode(result.dentry);
-		if (ext4_sb_feature_incom(sb, EXT4_FINCOM_FILETYPE)) {
-			uint8_t t;
-			t = ext4_dir_en_get_inode_type(sb, result.dentry);
-			imode = ext4_fs_correspond_inode_mode(t);
-		} else {
-			struct ext4_inode_ref child_ref;
-			r = ext4_fs_get_inode_ref(fs, next_inode, &child_ref);
-			if (r != EOK)
-				break;
-
-			imode = ext4_inode_type(sb, child_ref.inode);
-			ext4_fs_put_inode_ref(&child_ref);
-		}
-
-		r = ext4_dir_destroy_result(&ref, &result);
-		if (r != EOK)
-			break;
-
 		/*If expected file error*/
 		if (imode != EXT4_INODE_MODE_DIRECTORY && !is_goal) {
 			r = ENOENT;
@@ -1084,6 +1227,14 @@ static int ext4_generic_open2(ext4_file *f, const char *path, int flags,
 		f->fsize = ext4_inode_get_size(sb, ref.inode);
 		f->inode = ref.index;
 		f->fpos = 0;
+		f->da_buf = NULL;
+		f->da_len = 0;
+		f->st_bytes = 0;
+		f->st_interval_ms = 0;
+		ext4_file_map_reset(f);
+#if CONFIG_BLOCK_DEV_READAHEAD
+		memset(&f->ra, 0, sizeof(f->ra));
+#endif
 
 		if (f->flags & O_APPEND)
 			f->fpos = f->fsize;
@@ -1137,14 +1288,12 @@ static int ext4_create_hardlink(const char *path,
 	int r;
 	int len;
 	struct ext4_mountpoint *mp = ext4_get_mount(path);
-	struct ext4_dir_search_result result;
 	struct ext4_inode_ref ref;
 
 	if (!mp)
 		return ENOENT;
 
 	struct ext4_fs *const fs = &mp->fs;
-	struct ext4_sblock *const sb = &mp->fs.sb;
 
 	/*Skip mount point*/
 	path += strlen(mp->name);
@@ -1164,44 +1313,20 @@ static int ext4_create_hardlink(const char *path,
 			break;
 		}
 
-		r = ext4_dir_find_entry(&result, &ref, path, len);
+		r = ext4_dir_lookup(mp, &ref, path, len, &next_inode,
+				    &inode_mode);
 		if (r != EOK) {
-
-			/*Destroy last result*/
-			ext4_dir_destroy_result(&ref, &result);
-
 			if (r != ENOENT || !is_goal)
 				break;
 
 			/*Link with root dir.*/
 			r = ext4_link(mp, &ref, child_ref, path, len, rename);
 			break;
-		} else if (r == EOK && is_goal) {
-			/*Destroy last result*/
-			ext4_dir_destroy_result(&ref, &result);
+		} else if (is_goal) {
 			r = EEXIST;
 			break;
 		}
 
-		next_inode = result.dentry->inode;
-		if (ext4_sb_feature_incom(sb, EXT4_FINCOM_FILETYPE)) {
-			uint8_t t;
-			t = ext4_dir_en_get_inode_type(sb, result.dentry);
-			inode_mode = ext4_fs_correspond_inode_mode(t);
-		} else {
-			struct ext4_inode_ref child_ref;
-			r = ext4_fs_get_inode_ref(fs, next_inode, &child_ref);
-			if (r != EOK)
-				break;
-
-			inode_mode = ext4_inode_type(sb, child_ref.inode);
-			ext4_fs_put_inode_ref(&child_ref);
-		}
-
-		r = ext4_dir_destroy_result(&ref, &result);
-		if (r != EOK)
-			break;
-
 		if (inode_mode != EXT4_INODE_MODE_DIRECTORY) {
 			r = is_goal ? EEXIST : ENOENT;
 			break;
@@ -1252,6 +1377,8 @@ static int ext4_remove_orig_reference(const char *path, uint32_t name_off,
 	if (r != EOK)
 		goto Finish;
 
+	ext4_dcache_remove(&mp->dc, parent_ref->index, path, len);
+
 	if (ext4_inode_is_type(&mp->fs.sb, child_ref->inode,
 			       EXT4_INODE_MODE_DIRECTORY)) {
 		ext4_fs_inode_links_count_dec(parent_ref);
@@ -1582,16 +1709,42 @@ int ext4_fopen2(ext4_file *file, const char *path, int flags)
 	return r;
 }
 
+/**@brief   Tag the buffers dirtied from now on with the file inode, so
+ *          that ext4_fsync can find them. Returns the previous tag.*/
+static uint32_t ext4_file_owner_push(ext4_file *file)
+{
+	struct ext4_bcache *bc = file->mp->fs.bdev->bc;
+	uint32_t owner = bc->owner;
+
+	bc->owner = file->inode;
+	return owner;
+}
+
+static void ext4_file_owner_pop(ext4_file *file, uint32_t owner)
+{
+	file->mp->fs.bdev->bc->owner = owner;
+}
+
 int ext4_fclose(ext4_file *file)
 {
+	int r = EOK;
 	ext4_assert(file && file->mp);
 
+	if (file->da_buf) {
+		EXT4_MP_LOCK(file->mp);
+		r = ext4_fdelalloc_flush(file);
+		EXT4_MP_UNLOCK(file->mp);
+		ext4_free(file->da_buf);
+		file->da_buf = NULL;
+		file->da_len = 0;
+	}
+
 	file->mp = 0;
 	file->flags = 0;
 	file->inode = 0;
 	file->fpos = file->fsize = 0;
 
-	return EOK;
+	return r;
 }
 
 static int ext4_ftruncate_no_lock(ext4_file *file, uint64_t size)
@@ -1608,7 +1761,7 @@ static int ext4_ftruncate_no_lock(ext4_file *file, uint64_t size)
 
 	/*Sync file size*/
 	file->fsize = ext4_inode_get_size(&file->mp->fs.sb, ref.inode);
-	if (file->fsize <= size) {
+	if (file->fsize < size) {
 		r = EOK;
 		goto Finish;
 	}
@@ -1641,6 +1794,7 @@ Finish:
 int ext4_ftruncate(ext4_file *f, uint64_t size)
 {
 	int r;
+	uint32_t owner;
 	ext4_assert(f && f->mp);
 
 	if (f->mp->fs.read_only)
@@ -1651,6 +1805,13 @@ int ext4_ftruncate(ext4_file *f, uint64_t size)
 
 	EXT4_MP_LOCK(f->mp);
 
+	r = ext4_fdelalloc_flush(f);
+	if (r != EOK) {
+		EXT4_MP_UNLOCK(f->mp);
+		return r;
+	}
+
+	owner = ext4_file_owner_push(f);
 	ext4_trans_start(f->mp);
 	r = ext4_ftruncate_no_lock(f, size);
 	if (r != EOK)
@@ -1658,156 +1819,593 @@ int ext4_ftruncate(ext4_file *f, uint64_t size)
 	else
 		ext4_trans_stop(f->mp);
 
+	ext4_file_owner_pop(f, owner);
 	EXT4_MP_UNLOCK(f->mp);
 	return r;
 }
 
-int ext4_fread(ext4_file *file, void *buf, size_t size, size_t *rcnt)
+/**@brief   Zero len bytes at pos, all inside one block of the file.
+ *          Holes and unwritten blocks read as zeros already.*/
+static int ext4_file_zero_part(struct ext4_inode_ref *ref, uint64_t pos,
+			       uint32_t len)
 {
-	uint32_t unalg;
-	uint32_t iblock_idx;
-	uint32_t iblock_last;
-	uint32_t block_size;
-
+	int r;
+	struct ext4_block b;
 	ext4_fsblk_t fblock;
-	ext4_fsblk_t fblock_start;
-	uint32_t fblock_count;
+	struct ext4_fs *fs = ref->fs;
+	uint32_t block_size = ext4_sb_get_block_size(&fs->sb);
 
-	uint8_t *u8_buf = buf;
+	if (!len)
+		return EOK;
+
+	r = ext4_fs_get_inode_dblk_idx(ref, (ext4_lblk_t)(pos / block_size),
+				       &fblock, true);
+	if (r != EOK || !fblock)
+		return r;
+
+	r = ext4_block_get(fs->bdev, &b, fblock);
+	if (r != EOK)
+		return r;
+
+	memset(b.data + pos % block_size, 0, len);
+	ext4_bcache_set_dirty(b.buf);
+	return ext4_block_set(fs->bdev, &b);
+}
+
+int ext4_fallocate(ext4_file *file, uint64_t offset, uint64_t len,
+		   int flags)
+{
 	int r;
+	uint32_t cnt, owner;
+	uint64_t iblock, iblock_end;
 	struct ext4_inode_ref ref;
-
 	ext4_assert(file && file->mp);
 
-	if (file->flags & O_WRONLY)
+	struct ext4_fs *const fs = &file->mp->fs;
+	uint32_t block_size = ext4_sb_get_block_size(&fs->sb);
+
+	if (fs->read_only)
+		return EROFS;
+
+	if (file->flags & O_RDONLY)
 		return EPERM;
 
-	if (!size)
-		return EOK;
+	if (!len)
+		return EINVAL;
+
+	iblock = offset / block_size;
+	iblock_end = (offset + len + block_size - 1) / block_size;
+	if (offset + len < offset || iblock_end > EXT_MAX_BLOCKS)
+		return EFBIG;
 
 	EXT4_MP_LOCK(file->mp);
 
-	struct ext4_fs *const fs = &file->mp->fs;
-	struct ext4_sblock *const sb = &file->mp->fs.sb;
+	r = ext4_fdelalloc_flush(file);
+	if (r != EOK) {
+		EXT4_MP_UNLOCK(file->mp);
+		return r;
+	}
 
-	if (rcnt)
-		*rcnt = 0;
+	owner = ext4_file_owner_push(file);
+	ext4_trans_start(file->mp);
 
 	r = ext4_fs_get_inode_ref(fs, file->inode, &ref);
 	if (r != EOK) {
+		ext4_trans_abort(file->mp);
+		ext4_file_owner_pop(file, owner);
 		EXT4_MP_UNLOCK(file->mp);
 		return r;
 	}
 
-	/*Sync file size*/
-	file->fsize = ext4_inode_get_size(sb, ref.inode);
-
-	block_size = ext4_sb_get_block_size(sb);
-	size = ((uint64_t)size > (file->fsize - file->fpos))
-		? ((size_t)(file->fsize - file->fpos)) : size;
-
-	iblock_idx = (uint32_t)((file->fpos) / block_size);
-	iblock_last = (uint32_t)((file->fpos + size) / block_size);
-	unalg = (file->fpos) % block_size;
-
-	/*If the size of symlink is smaller than 60 bytes*/
-	bool softlink;
-	softlink = ext4_inode_is_type(sb, ref.inode, EXT4_INODE_MODE_SOFTLINK);
-	if (softlink && file->fsize < sizeof(ref.inode->blocks)
-		     && !ext4_inode_get_blocks_count(sb, ref.inode)) {
-
-		char *content = (char *)ref.inode->blocks;
-		if (file->fpos < file->fsize) {
-			size_t len = size;
-			if (unalg + size > (uint32_t)file->fsize)
-				len = (uint32_t)file->fsize - unalg;
-			memcpy(buf, content + unalg, len);
-			if (rcnt)
-				*rcnt = len;
-
-		}
+	/*One extent insert per run of free blocks*/
+	while (iblock < iblock_end) {
+		r = ext4_fs_prealloc_inode_dblks(&ref, (uint32_t)iblock,
+						 (uint32_t)(iblock_end - iblock),
+						 &cnt);
+		if (r != EOK)
+			break;
 
-		r = EOK;
-		goto Finish;
+		iblock += cnt;
 	}
 
-	if (unalg) {
-		size_t len =  size;
-		if (size > (block_size - unalg))
-			len = block_size - unalg;
-
-		r = ext4_fs_get_inode_dblk_idx(&ref, iblock_idx, &fblock, true);
-		if (r != EOK)
-			goto Finish;
-
-		/* Do we get an unwritten range? */
-		if (fblock != 0) {
-			uint64_t off = fblock * block_size + unalg;
-			r = ext4_block_readbytes(file->mp->fs.bdev, off, u8_buf, len);
+	file->fsize = ext4_inode_get_size(&fs->sb, ref.inode);
+	if (r == EOK && !(flags & EXT4_FALLOC_KEEP_SIZE) &&
+	    offset + len > file->fsize) {
+		/*Truncate leaves old data past the end of file in its last
+		 * block, growing the file must not bring it back*/
+		if (file->fsize % block_size) {
+			r = ext4_file_zero_part(&ref, file->fsize,
+				block_size - file->fsize % block_size);
 			if (r != EOK)
 				goto Finish;
-
-		} else {
-			/* Yes, we do. */
-			memset(u8_buf, 0, len);
 		}
 
-		u8_buf += len;
-		size -= len;
-		file->fpos += len;
-
-		if (rcnt)
-			*rcnt += len;
-
-		iblock_idx++;
+		file->fsize = offset + len;
+		ext4_inode_set_size(ref.inode, file->fsize);
+		ref.dirty = true;
 	}
 
-	fblock_start = 0;
-	fblock_count = 0;
-	while (size >= block_size) {
-		while (iblock_idx < iblock_last) {
-			r = ext4_fs_get_inode_dblk_idx(&ref, iblock_idx,
-						       &fblock, true);
-			if (r != EOK)
-				goto Finish;
+Finish:
+	if (r == EOK)
+		r = ext4_fs_put_inode_ref(&ref);
+	else
+		ext4_fs_put_inode_ref(&ref);
 
-			iblock_idx++;
+	if (r != EOK)
+		ext4_trans_abort(file->mp);
+	else
+		ext4_trans_stop(file->mp);
 
-			if (!fblock_start)
-				fblock_start = fblock;
+	ext4_file_owner_pop(file, owner);
+	EXT4_MP_UNLOCK(file->mp);
+	return r;
+}
 
-			if ((fblock_start + fblock_count) != fblock)
-				break;
+int ext4_fpunch(ext4_file *file, uint64_t offset, uint64_t len)
+{
+	int r;
+	uint32_t owner;
+	uint64_t end, first, last;
+	struct ext4_inode_ref ref;
+	ext4_assert(file && file->mp);
 
-			fblock_count++;
-		}
+	struct ext4_fs *const fs = &file->mp->fs;
+	uint32_t block_size = ext4_sb_get_block_size(&fs->sb);
 
-		r = ext4_blocks_get_direct(file->mp->fs.bdev, u8_buf, fblock_start,
-					   fblock_count);
-		if (r != EOK)
-			goto Finish;
+	if (fs->read_only)
+		return EROFS;
 
-		size -= block_size * fblock_count;
-		u8_buf += block_size * fblock_count;
-		file->fpos += block_size * fblock_count;
+	if (file->flags & O_RDONLY)
+		return EPERM;
 
-		if (rcnt)
-			*rcnt += block_size * fblock_count;
+	if (!len || offset + len < offset)
+		return EINVAL;
 
-		fblock_start = fblock;
-		fblock_count = 1;
-	}
+	EXT4_MP_LOCK(file->mp);
 
-	if (size) {
-		uint64_t off;
-		r = ext4_fs_get_inode_dblk_idx(&ref, iblock_idx, &fblock, true);
+	r = ext4_fdelalloc_flush(file);
+	if (r != EOK) {
+		EXT4_MP_UNLOCK(file->mp);
+		return r;
+	}
+
+	owner = ext4_file_owner_push(file);
+	ext4_trans_start(file->mp);
+
+	r = ext4_fs_get_inode_ref(fs, file->inode, &ref);
+	if (r != EOK) {
+		ext4_trans_abort(file->mp);
+		ext4_file_owner_pop(file, owner);
+		EXT4_MP_UNLOCK(file->mp);
+		return r;
+	}
+
+	/*Check support before zeroing anything*/
+	r = ext4_fs_punch_inode_dblks(&ref, 0, 0);
+	if (r != EOK)
+		goto Finish;
+
+	/*Nothing past the end of file is read back*/
+	file->fsize = ext4_inode_get_size(&fs->sb, ref.inode);
+	end = offset + len;
+	if (end > file->fsize)
+		end = file->fsize;
+	if (offset >= end)
+		goto Finish;
+
+	/*Whole blocks are freed, the ends of the range are zeroed*/
+	first = (offset + block_size - 1) / block_size;
+	last = end / block_size;
+	if (first > last) {
+		r = ext4_file_zero_part(&ref, offset, (uint32_t)(end - offset));
+		goto Finish;
+	}
+
+	r = ext4_file_zero_part(&ref, offset,
+				(uint32_t)(first * block_size - offset));
+	if (r != EOK)
+		goto Finish;
+
+	r = ext4_file_zero_part(&ref, last * block_size,
+				(uint32_t)(end - last * block_size));
+	if (r != EOK)
+		goto Finish;
+
+	if (first < last) {
+		r = ext4_fs_punch_inode_dblks(&ref, (ext4_lblk_t)first,
+					      (ext4_lblk_t)(last - first));
 		if (r != EOK)
 			goto Finish;
+	}
 
-		off = fblock * block_size;
-		r = ext4_block_readbytes(file->mp->fs.bdev, off, u8_buf, size);
+Finish:
+	if (r == EOK)
+		r = ext4_fs_put_inode_ref(&ref);
+	else
+		ext4_fs_put_inode_ref(&ref);
+
+	if (r != EOK)
+		ext4_trans_abort(file->mp);
+	else
+		ext4_trans_stop(file->mp);
+
+	ext4_file_owner_pop(file, owner);
+	EXT4_MP_UNLOCK(file->mp);
+	return r;
+}
+
+/**@brief   Whether a data block has valid contents in the cache.*/
+static bool ext4_fblock_cached(struct ext4_fs *fs, ext4_fsblk_t fblock)
+{
+	struct ext4_buf *buf = ext4_buf_lookup(fs->bdev->bc, fblock);
+	return buf && ext4_bcache_test_flag(buf, BC_UPTODATE);
+}
+
+/**@brief   Read or write part of a data block of an EXT4_O_DIRECT file
+ *          that is not cached, without putting it in the cache. Fresh
+ *          blocks are not read.*/
+static int ext4_fblock_rw_part_direct(struct ext4_fs *fs, ext4_fsblk_t fblock,
+				      uint32_t off, void *buf, size_t len,
+				      bool write, bool fresh)
+{
+	int r;
+	uint32_t block_size = ext4_sb_get_block_size(&fs->sb);
+	uint8_t *tmp = ext4_malloc(block_size);
+
+	if (!tmp)
+		return ENOMEM;
+
+	if (fresh)
+		memset(tmp, 0, block_size);
+	else {
+		r = ext4_blocks_get_direct(fs->bdev, tmp, fblock, 1);
 		if (r != EOK)
 			goto Finish;
+	}
+
+	if (!write) {
+		memcpy(buf, tmp + off, len);
+		r = EOK;
+		goto Finish;
+	}
+
+	memcpy(tmp + off, buf, len);
+	r = ext4_blocks_set_direct(fs->bdev, tmp, fblock, 1);
+
+Finish:
+	ext4_free(tmp);
+	return r;
+}
+
+/**@brief   Read part of a data block through the block cache.
+ *          EXT4_O_DIRECT files use the cache only if the block is there
+ *          already. The block is the first of run blocks of the file in
+ *          a row, which the readahead of the file may read with it.*/
+static int ext4_fblock_read_part(ext4_file *file, ext4_fsblk_t fblock,
+				 uint32_t run, uint32_t off, void *buf,
+				 size_t len, bool direct)
+{
+	int r;
+	struct ext4_block b;
+	struct ext4_fs *fs = &file->mp->fs;
+
+	if (direct && !ext4_fblock_cached(fs, fblock))
+		return ext4_fblock_rw_part_direct(fs, fblock, off, buf, len,
+						  false, false);
+
+#if CONFIG_BLOCK_DEV_READAHEAD
+	r = ext4_block_get_ra(fs->bdev, &b, fblock, direct ? NULL : &file->ra,
+			      run);
+#else
+	(void)run;
+	r = ext4_block_get(fs->bdev, &b, fblock);
+#endif
+	if (r != EOK)
+		return r;
+
+	memcpy(buf, b.data + off, len);
+	return ext4_block_set(fs->bdev, &b);
+}
+
+/**@brief   Write part of a data block through the block cache. The block
+ *          is written back once it leaves the cache (write back mode).
+ *          Blocks just appended or allocated (fresh) are not read, the
+ *          rest of such block is zeroed. EXT4_O_DIRECT files use the
+ *          cache only if the block is there already.*/
+static int ext4_fblock_write_part(struct ext4_fs *fs, ext4_fsblk_t fblock,
+				  uint32_t off, const void *buf, size_t len,
+				  bool fresh, bool direct)
+{
+	int r;
+	struct ext4_block b;
+	uint32_t block_size = ext4_sb_get_block_size(&fs->sb);
+
+	if (direct && !ext4_fblock_cached(fs, fblock))
+		return ext4_fblock_rw_part_direct(fs, fblock, off, (void *)buf,
+						  len, true, fresh);
+
+	if (fresh) {
+		r = ext4_block_get_noread(fs->bdev, &b, fblock);
+		if (r != EOK)
+			return r;
+
+		memset(b.data, 0, block_size);
+		ext4_bcache_set_flag(b.buf, BC_UPTODATE);
+	} else {
+		r = ext4_block_get(fs->bdev, &b, fblock);
+		if (r != EOK)
+			return r;
+	}
+
+	memcpy(b.data + off, buf, len);
+	ext4_bcache_set_dirty(b.buf);
+	return ext4_block_set(fs->bdev, &b);
+}
+
+/**@brief   Map a run of at most max_blocks logical blocks from iblock,
+ *          using the runs cached in the file descriptor when possible.
+ *          Same results as @ref ext4_fs_get_inode_dblk_run.*/
+static int ext4_file_map_run(ext4_file *file, struct ext4_inode_ref *ref,
+			     uint32_t iblock, uint32_t max_blocks,
+			     ext4_fsblk_t *fblock, uint32_t *blocks_count)
+{
+#if CONFIG_EXT4_FILE_MAP_CACHE
+	int r;
+	uint32_t i;
+	uint32_t fill = max_blocks;
+	struct ext4_file_map *m;
+	struct ext4_fs *fs = ref->fs;
+
+	if (file->map_gen != fs->map_gen)
+		ext4_file_map_reset(file);
+
+	for (i = 0; i < CONFIG_EXT4_FILE_MAP_CACHE; i++) {
+		m = &file->map[i];
+		if (iblock - m->lblk < m->len) {
+			*fblock = m->pblk + (iblock - m->lblk);
+			*blocks_count = m->len - (iblock - m->lblk);
+			if (*blocks_count > max_blocks)
+				*blocks_count = max_blocks;
+			return EOK;
+		}
+	}
+
+	/*One extent lookup costs the same for any length, remember the
+	 * whole extent for the calls that follow*/
+	if (ext4_sb_feature_incom(&fs->sb, EXT4_FINCOM_EXTENTS) &&
+	    ext4_inode_has_flag(ref->inode, EXT4_INODE_FLAG_EXTENTS))
+		fill = UINT32_MAX - iblock;
+
+	r = ext4_fs_get_inode_dblk_run(ref, iblock, fill, fblock,
+				       blocks_count);
+	if (r != EOK)
+		return r;
+
+	if (*fblock) {
+		m = &file->map[file->map_next];
+		m->lblk = iblock;
+		m->len = *blocks_count;
+		m->pblk = *fblock;
+		file->map_next = (file->map_next + 1) %
+				 CONFIG_EXT4_FILE_MAP_CACHE;
+	}
+
+	if (*blocks_count > max_blocks)
+		*blocks_count = max_blocks;
+	return EOK;
+#else
+	(void)file;
+	return ext4_fs_get_inode_dblk_run(ref, iblock, max_blocks, fblock,
+					  blocks_count);
+#endif
+}
+
+/**@brief   Physical block of an existing logical block that is about to
+ *          be overwritten. Holes and unwritten ranges are allocated or
+ *          initialized, fresh is set as their old contents must read
+ *          as zeros (see @ref ext4_fblock_write_part).*/
+static int ext4_file_map_write(ext4_file *file, struct ext4_inode_ref *ref,
+			       uint32_t iblock, ext4_fsblk_t *fblock,
+			       bool *fresh)
+{
+	uint32_t cnt;
+	int r = ext4_file_map_run(file, ref, iblock, 1, fblock, &cnt);
+
+	*fresh = false;
+	if (r != EOK || *fblock)
+		return r;
+
+	*fresh = true;
+	return ext4_fs_init_inode_dblk_run(ref, iblock, 1, fblock, &cnt);
+}
+
+/**@brief   Blocks to map for a partial block read at iblock: up to the
+ *          readahead window, without going past the end of the file.*/
+static uint32_t ext4_file_ra_max(ext4_file *file, uint32_t iblock,
+				 uint32_t block_size)
+{
+#if CONFIG_BLOCK_DEV_READAHEAD
+	uint64_t end = (file->fsize + block_size - 1) / block_size;
+
+	if (end <= iblock)
+		return 1;
+	if (end - iblock < CONFIG_BLOCK_DEV_READAHEAD)
+		return (uint32_t)(end - iblock);
+	return CONFIG_BLOCK_DEV_READAHEAD;
+#else
+	(void)file;
+	(void)iblock;
+	(void)block_size;
+	return 1;
+#endif
+}
+
+/**@brief   Whole blocks left in a read or write of size bytes.*/
+static uint32_t ext4_file_run_max(size_t size, uint32_t block_size)
+{
+	size_t cnt = size / block_size;
+	return cnt > UINT32_MAX ? UINT32_MAX : (uint32_t)cnt;
+}
+
+int ext4_fread(ext4_file *file, void *buf, size_t size, size_t *rcnt)
+{
+	uint32_t unalg;
+	uint32_t iblock_idx;
+	uint32_t block_size;
+
+	ext4_fsblk_t fblock;
+	uint32_t fblock_count;
+
+	uint8_t *u8_buf = buf;
+	int r, rr;
+	struct ext4_inode_ref ref;
+	bool direct = (file->flags & EXT4_O_DIRECT) != 0;
+
+	ext4_assert(file && file->mp);
+
+	if (file->flags & O_WRONLY)
+		return EPERM;
+
+	if (!size)
+		return EOK;
+
+	EXT4_MP_LOCK(file->mp);
+
+	struct ext4_fs *const fs = &file->mp->fs;
+	struct ext4_sblock *const sb = &file->mp->fs.sb;
+
+	if (rcnt)
+		*rcnt = 0;
+
+	/*Buffered appends go to the disk before anything is read*/
+	r = ext4_fdelalloc_flush(file);
+	if (r != EOK) {
+		EXT4_MP_UNLOCK(file->mp);
+		return r;
+	}
+
+	r = ext4_fs_get_inode_ref(fs, file->inode, &ref);
+	if (r != EOK) {
+		EXT4_MP_UNLOCK(file->mp);
+		return r;
+	}
+
+	/*Sync file size*/
+	file->fsize = ext4_inode_get_size(sb, ref.inode);
+
+	block_size = ext4_sb_get_block_size(sb);
+	size = ((uint64_t)size > (file->fsize - file->fpos))
+		? ((size_t)(file->fsize - file->fpos)) : size;
+
+	iblock_idx = (uint32_t)((file->fpos) / block_size);
+	unalg = (file->fpos) % block_size;
+
+	/*If the size of symlink is smaller than 60 bytes*/
+	bool softlink;
+	softlink = ext4_inode_is_type(sb, ref.inode, EXT4_INODE_MODE_SOFTLINK);
+	if (softlink && file->fsize < sizeof(ref.inode->blocks)
+		     && !ext4_inode_get_blocks_count(sb, ref.inode)) {
+
+		char *content = (char *)ref.inode->blocks;
+		if (file->fpos < file->fsize) {
+			size_t len = size;
+			if (unalg + size > (uint32_t)file->fsize)
+				len = (uint32_t)file->fsize - unalg;
+			memcpy(buf, content + unalg, len);
+			if (rcnt)
+				*rcnt = len;
+
+		}
+
+		r = EOK;
+		goto Finish;
+	}
+
+	if (unalg) {
+		size_t len =  size;
+		if (size > (block_size - unalg))
+			len = block_size - unalg;
+
+		r = ext4_file_map_run(file, &ref, iblock_idx,
+				      ext4_file_ra_max(file, iblock_idx,
+						       block_size),
+				      &fblock, &fblock_count);
+		if (r != EOK)
+			goto Finish;
+
+		/* Do we get an unwritten range? */
+		if (fblock != 0) {
+			r = ext4_fblock_read_part(file, fblock, fblock_count,
+						  unalg, u8_buf, len, direct);
+			if (r != EOK)
+				goto Finish;
+
+		} else {
+			/* Yes, we do. */
+			memset(u8_buf, 0, len);
+		}
+
+		u8_buf += len;
+		size -= len;
+		file->fpos += len;
+
+		if (rcnt)
+			*rcnt += len;
+
+		iblock_idx++;
+	}
+
+	while (size >= block_size) {
+		/*Map as much of the remaining whole blocks as one run*/
+		r = ext4_file_map_run(file, &ref, iblock_idx,
+				      ext4_file_run_max(size, block_size),
+				      &fblock, &fblock_count);
+		if (r != EOK)
+			goto Finish;
+
+		if (fblock != 0) {
+			/*Partial writes may have left newer data in the cache*/
+			r = ext4_block_flush_lba_range(file->mp->fs.bdev,
+						       fblock, fblock_count);
+			if (r != EOK)
+				goto Finish;
+
+			r = ext4_blocks_get_direct_async(file->mp->fs.bdev,
+							 u8_buf, fblock,
+							 fblock_count);
+			if (r != EOK)
+				goto Finish;
+		} else {
+			/*Hole or unwritten range*/
+			memset(u8_buf, 0, (size_t)block_size * fblock_count);
+		}
+
+		size -= (size_t)block_size * fblock_count;
+		u8_buf += (size_t)block_size * fblock_count;
+		file->fpos += (size_t)block_size * fblock_count;
+
+		if (rcnt)
+			*rcnt += (size_t)block_size * fblock_count;
+
+		iblock_idx += fblock_count;
+	}
+
+	if (size) {
+		r = ext4_file_map_run(file, &ref, iblock_idx,
+				      ext4_file_ra_max(file, iblock_idx,
+						       block_size),
+				      &fblock, &fblock_count);
+		if (r != EOK)
+			goto Finish;
+
+		if (fblock != 0) {
+			r = ext4_fblock_read_part(file, fblock, fblock_count, 0,
+						  u8_buf, size, direct);
+			if (r != EOK)
+				goto Finish;
+		} else {
+			memset(u8_buf, 0, size);
+		}
 
 		file->fpos += size;
 
@@ -1816,39 +2414,33 @@ int ext4_fread(ext4_file *file, void *buf, size_t size, size_t *rcnt)
 	}
 
 Finish:
+	/*Collect the reads still in flight*/
+	rr = ext4_blocks_wait(file->mp->fs.bdev);
+	if (r == EOK)
+		r = rr;
+
 	ext4_fs_put_inode_ref(&ref);
 	EXT4_MP_UNLOCK(file->mp);
 	return r;
 }
 
-int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt)
+static int ext4_fwrite_no_lock(ext4_file *file, const void *buf, size_t size,
+			       size_t *wcnt)
 {
 	uint32_t unalg;
 	uint32_t iblk_idx;
-	uint32_t iblock_last;
 	uint32_t ifile_blocks;
 	uint32_t block_size;
 
 	uint32_t fblock_count;
 	ext4_fsblk_t fblk;
-	ext4_fsblk_t fblock_start;
 
 	struct ext4_inode_ref ref;
 	const uint8_t *u8_buf = buf;
 	int r, rr = EOK;
+	bool direct = (file->flags & EXT4_O_DIRECT) != 0;
+	uint32_t owner = ext4_file_owner_push(file);
 
-//	ext4_assert(file && file->mp);
-
-	if (file->mp->fs.read_only)
-		return EROFS;
-
-	if (file->flags & O_RDONLY)
-		return EPERM;
-
-	if (!size)
-		return EOK;
-
-	EXT4_MP_LOCK(file->mp);
 	ext4_trans_start(file->mp);
 
 	struct ext4_fs *const fs = &file->mp->fs;
@@ -1860,7 +2452,7 @@ int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt)
 	r = ext4_fs_get_inode_ref(fs, file->inode, &ref);
 	if (r != EOK) {
 		ext4_trans_abort(file->mp);
-		EXT4_MP_UNLOCK(file->mp);
+		ext4_file_owner_pop(file, owner);
 		return r;
 	}
 
@@ -1868,7 +2460,6 @@ int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt)
 	file->fsize = ext4_inode_get_size(sb, ref.inode);
 	block_size = ext4_sb_get_block_size(sb);
 
-	iblock_last = (uint32_t)((file->fpos + size) / block_size);
 	iblk_idx = (uint32_t)(file->fpos / block_size);
 	ifile_blocks = (uint32_t)((file->fsize + block_size - 1) / block_size);
 
@@ -1876,16 +2467,16 @@ int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt)
 
 	if (unalg) {
 		size_t len =  size;
-		uint64_t off;
 		if (size > (block_size - unalg))
 			len = block_size - unalg;
 
-		r = ext4_fs_init_inode_dblk_idx(&ref, iblk_idx, &fblk);
+		bool fresh;
+		r = ext4_file_map_write(file, &ref, iblk_idx, &fblk, &fresh);
 		if (r != EOK)
 			goto Finish;
 
-		off = fblk * block_size + unalg;
-		r = ext4_block_writebytes(file->mp->fs.bdev, off, u8_buf, len);
+		r = ext4_fblock_write_part(fs, fblk, unalg, u8_buf, len, fresh,
+					   direct);
 		if (r != EOK)
 			goto Finish;
 
@@ -1904,61 +2495,55 @@ int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt)
 	if (r != EOK)
 		goto Finish;
 
-	fblock_start = 0;
-	fblock_count = 0;
 	while (size >= block_size) {
+		uint32_t max = ext4_file_run_max(size, block_size);
 
-		while (iblk_idx < iblock_last) {
-			if (iblk_idx < ifile_blocks) {
-				r = ext4_fs_init_inode_dblk_idx(&ref, iblk_idx,
-								&fblk);
-				if (r != EOK)
-					goto Finish;
-			} else {
-				rr = ext4_fs_append_inode_dblk(&ref, &fblk,
-							       &iblk_idx);
-				if (rr != EOK) {
-					/* Unable to append more blocks. But
-					 * some block might be allocated already
-					 * */
-					break;
-				}
-			}
+		if (iblk_idx < ifile_blocks) {
+			/*Overwrite a run of written blocks*/
+			if (max > ifile_blocks - iblk_idx)
+				max = ifile_blocks - iblk_idx;
 
-			iblk_idx++;
+			r = ext4_file_map_run(file, &ref, iblk_idx, max, &fblk,
+					      &fblock_count);
+			if (r != EOK)
+				break;
 
-			if (!fblock_start) {
-				fblock_start = fblk;
+			if (!fblk) {
+				/*Hole or unwritten range, nothing to zero as
+				 * all of it gets overwritten*/
+				r = ext4_fs_init_inode_dblk_run(&ref, iblk_idx,
+								fblock_count,
+								&fblk,
+								&fblock_count);
+				if (r != EOK)
+					break;
 			}
-
-			if ((fblock_start + fblock_count) != fblk)
+		} else {
+			/*Allocate the whole rest of the write at once*/
+			rr = ext4_fs_append_inode_dblks(&ref, max, &fblk,
+							&iblk_idx,
+							&fblock_count);
+			if (rr != EOK)
 				break;
-
-			fblock_count++;
 		}
 
-		r = ext4_blocks_set_direct(file->mp->fs.bdev, u8_buf, fblock_start,
+		/*Older copies in the cache must not be written back later*/
+		ext4_bcache_invalidate_lba(file->mp->fs.bdev->bc, fblk,
 					   fblock_count);
+
+		r = ext4_blocks_set_direct_async(file->mp->fs.bdev, u8_buf,
+						 fblk, fblock_count);
 		if (r != EOK)
 			break;
 
-		size -= block_size * fblock_count;
-		u8_buf += block_size * fblock_count;
-		file->fpos += block_size * fblock_count;
+		size -= (size_t)block_size * fblock_count;
+		u8_buf += (size_t)block_size * fblock_count;
+		file->fpos += (size_t)block_size * fblock_count;
 
 		if (wcnt)
-			*wcnt += block_size * fblock_count;
+			*wcnt += (size_t)block_size * fblock_count;
 
-		fblock_start = fblk;
-		fblock_count = 1;
-
-		if (rr != EOK) {
-			/*ext4_fs_append_inode_block has failed and no
-			 * more blocks might be written. But node size
-			 * should be updated.*/
-			r = rr;
-			goto out_fsize;
-		}
+		iblk_idx += fblock_count;
 	}
 
 	/*Stop write back cache mode*/
@@ -1967,10 +2552,18 @@ int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt)
 	if (r != EOK)
 		goto Finish;
 
+	if (rr != EOK) {
+		/*Unable to append more blocks, but the blocks written so far
+		 * count. Node size should be updated.*/
+		r = rr;
+		goto out_fsize;
+	}
+
 	if (size) {
-		uint64_t off;
+		bool fresh = false;
 		if (iblk_idx < ifile_blocks) {
-			r = ext4_fs_init_inode_dblk_idx(&ref, iblk_idx, &fblk);
+			r = ext4_file_map_write(file, &ref, iblk_idx, &fblk,
+						&fresh);
 			if (r != EOK)
 				goto Finish;
 		} else {
@@ -1978,10 +2571,11 @@ int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt)
 			if (r != EOK)
 				/*Node size sholud be updated.*/
 				goto out_fsize;
+			fresh = true;
 		}
 
-		off = fblk * block_size;
-		r = ext4_block_writebytes(file->mp->fs.bdev, off, u8_buf, size);
+		r = ext4_fblock_write_part(fs, fblk, 0, u8_buf, size, fresh,
+					   direct);
 		if (r != EOK)
 			goto Finish;
 
@@ -1999,13 +2593,338 @@ out_fsize:
 	}
 
 Finish:
+	/*Collect the writes still in flight*/
+	rr = ext4_blocks_wait(file->mp->fs.bdev);
 	r = ext4_fs_put_inode_ref(&ref);
+	if (r == EOK)
+		r = rr;
 
 	if (r != EOK)
 		ext4_trans_abort(file->mp);
 	else
 		ext4_trans_stop(file->mp);
 
+	ext4_file_owner_pop(file, owner);
+	return r;
+}
+
+/**@brief   Write the delayed allocation buffer to the file. Blocks for
+ *          the whole buffer are allocated by one ext4_fwrite_no_lock.
+ *          The buffer is dropped if the file was removed meanwhile.
+ *          An inode number freed and used again by another regular file
+ *          is not told apart (the generation is always 0), so a handle
+ *          must not hold appends across removing its file.*/
+static int ext4_fdelalloc_flush(ext4_file *file)
+{
+	int r;
+	size_t wcnt;
+	bool gone;
+	uint64_t fpos = file->fpos;
+	uint64_t fsize = file->fsize;
+	struct ext4_inode_ref ref;
+
+	if (!file->da_len)
+		return EOK;
+
+	r = ext4_fs_get_inode_ref(&file->mp->fs, file->inode, &ref);
+	if (r != EOK)
+		return r;
+
+	gone = !ext4_inode_get_links_cnt(ref.inode) ||
+	       !ext4_inode_is_type(&file->mp->fs.sb, ref.inode,
+				   EXT4_INODE_MODE_FILE);
+	r = ext4_fs_put_inode_ref(&ref);
+	if (r != EOK)
+		return r;
+
+	if (gone) {
+		file->da_len = 0;
+		return EOK;
+	}
+
+	file->fpos = file->da_pos;
+	r = ext4_fwrite_no_lock(file, file->da_buf, file->da_len, &wcnt);
+	if (r == EOK && wcnt != file->da_len)
+		r = ENOSPC;
+
+	/*Keep what did not make it to the disk*/
+	file->da_pos += wcnt;
+	file->da_len -= (uint32_t)wcnt;
+	memmove(file->da_buf, file->da_buf + wcnt, file->da_len);
+
+	file->fpos = fpos;
+	if (file->fsize < fsize)
+		file->fsize = fsize;
+	return r;
+}
+
+/**@brief   Write back the buffers tagged with the file inode. fsync
+ *          writes the inode table block, too, whoever dirtied it.*/
+static int ext4_fsync_no_lock(ext4_file *file, bool datasync)
+{
+	int r;
+	uint64_t ino_lba = 0;
+	struct ext4_inode_ref ref;
+	struct ext4_blockdev *bdev = file->mp->fs.bdev;
+
+	r = ext4_fdelalloc_flush(file);
+	if (r != EOK)
+		return r;
+
+	if (!datasync) {
+		r = ext4_fs_get_inode_ref(&file->mp->fs, file->inode, &ref);
+		if (r != EOK)
+			return r;
+
+		ino_lba = ref.block.lb_id;
+		r = ext4_fs_put_inode_ref(&ref);
+		if (r != EOK)
+			return r;
+	}
+
+	r = ext4_block_cache_flush_owner(bdev, file->inode);
+	if (r == EOK && ino_lba)
+		r = ext4_block_flush_lba(bdev, ino_lba);
+
+	return r;
+}
+
+/**@brief   Size of the delayed allocation buffer of a file (0 - none).*/
+static uint32_t ext4_fdelalloc_cap(ext4_file *file)
+{
+	if (file->flags & EXT4_O_DIRECT)
+		return 0;
+
+	return file->st_bytes ? file->st_bytes : file->mp->delalloc_bytes;
+}
+
+/**@brief   Append to the file through the delayed allocation buffer.
+ *          Nothing is allocated until the buffer is full, or the file
+ *          is read, truncated, written elsewhere, flushed or closed.
+ *          In append stream mode the file also goes to the disk once
+ *          per interval.*/
+static int ext4_fwrite_delalloc(ext4_file *file, const void *buf,
+				size_t size, size_t *wcnt)
+{
+	int r;
+	size_t n;
+	uint32_t now;
+	const uint8_t *u8_buf = buf;
+	uint32_t cap = ext4_fdelalloc_cap(file);
+
+	if (wcnt)
+		*wcnt = 0;
+
+	if (!file->da_buf) {
+		file->da_buf = ext4_malloc(cap);
+		if (!file->da_buf)
+			return ext4_fwrite_no_lock(file, buf, size, wcnt);
+	}
+
+	if (!file->da_len)
+		file->da_pos = file->fpos;
+
+	while (size) {
+		if (!file->da_len && size >= cap) {
+			/*Nothing to gain from buffering a large write*/
+			r = ext4_fwrite_no_lock(file, u8_buf, size, &n);
+			if (wcnt)
+				*wcnt += n;
+			return r;
+		}
+
+		n = cap - file->da_len;
+		if (n > size)
+			n = size;
+
+		memcpy(file->da_buf + file->da_len, u8_buf, n);
+		file->da_len += (uint32_t)n;
+		file->fpos += n;
+		file->fsize = file->fpos;
+		u8_buf += n;
+		size -= n;
+		if (wcnt)
+			*wcnt += n;
+
+		if (file->da_len == cap) {
+			r = ext4_fdelalloc_flush(file);
+			if (r != EOK)
+				return r;
+			file->da_pos = file->fpos;
+		}
+	}
+
+	if (!file->st_interval_ms)
+		return EOK;
+
+	now = ext4_block_time_us();
+	if ((uint32_t)(now - file->st_time_us) <
+	    (uint64_t)file->st_interval_ms * 1000)
+		return EOK;
+
+	file->st_time_us = now;
+	return ext4_fsync_no_lock(file, true);
+}
+
+int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt)
+{
+	int r;
+
+//	ext4_assert(file && file->mp);
+
+	if (file->mp->fs.read_only)
+		return EROFS;
+
+	if (file->flags & O_RDONLY)
+		return EPERM;
+
+	if (!size)
+		return EOK;
+
+	EXT4_MP_LOCK(file->mp);
+
+	if (ext4_fdelalloc_cap(file) && file->fpos == file->fsize) {
+		r = ext4_fwrite_delalloc(file, buf, size, wcnt);
+	} else {
+		r = ext4_fdelalloc_flush(file);
+		if (r == EOK)
+			r = ext4_fwrite_no_lock(file, buf, size, wcnt);
+		else if (wcnt)
+			*wcnt = 0;
+	}
+
+	EXT4_MP_UNLOCK(file->mp);
+	return r;
+}
+
+int ext4_fflush(ext4_file *file)
+{
+	int r;
+	ext4_assert(file && file->mp);
+
+	EXT4_MP_LOCK(file->mp);
+	r = ext4_fdelalloc_flush(file);
+	EXT4_MP_UNLOCK(file->mp);
+	return r;
+}
+
+int ext4_fsync(ext4_file *file)
+{
+	int r;
+	ext4_assert(file && file->mp);
+
+	EXT4_MP_LOCK(file->mp);
+	r = ext4_fsync_no_lock(file, false);
+	EXT4_MP_UNLOCK(file->mp);
+	return r;
+}
+
+int ext4_fdatasync(ext4_file *file)
+{
+	int r;
+	ext4_assert(file && file->mp);
+
+	EXT4_MP_LOCK(file->mp);
+	r = ext4_fsync_no_lock(file, true);
+	EXT4_MP_UNLOCK(file->mp);
+	return r;
+}
+
+int ext4_fstream(ext4_file *file, uint32_t bytes, uint32_t interval_ms)
+{
+	int r;
+	uint32_t cap;
+	ext4_assert(file && file->mp);
+
+	if (file->mp->fs.read_only)
+		return EROFS;
+
+	if (file->flags & O_RDONLY)
+		return EPERM;
+
+	if (file->flags & EXT4_O_DIRECT)
+		return EINVAL;
+
+	EXT4_MP_LOCK(file->mp);
+	r = ext4_fdelalloc_flush(file);
+	if (r != EOK) {
+		EXT4_MP_UNLOCK(file->mp);
+		return r;
+	}
+
+	cap = ext4_fdelalloc_cap(file);
+	file->st_bytes = bytes;
+	file->st_interval_ms = bytes ? interval_ms : 0;
+	file->st_time_us = ext4_block_time_us();
+
+	/*The buffer is allocated again on the next append*/
+	if (file->da_buf && ext4_fdelalloc_cap(file) != cap) {
+		ext4_free(file->da_buf);
+		file->da_buf = NULL;
+	}
+
+	EXT4_MP_UNLOCK(file->mp);
+	return EOK;
+}
+
+/**@brief   SEEK_DATA / SEEK_HOLE. Walks the block runs of the file from
+ *          offset, unwritten runs count as holes.*/
+static int ext4_fseek_data(ext4_file *file, int64_t offset, bool hole)
+{
+	int r;
+	uint32_t cnt;
+	uint64_t iblock, iblock_end;
+	ext4_fsblk_t fblock;
+	struct ext4_inode_ref ref;
+	struct ext4_fs *const fs = &file->mp->fs;
+	uint32_t block_size = ext4_sb_get_block_size(&fs->sb);
+
+	EXT4_MP_LOCK(file->mp);
+
+	/*Buffered appends become data first*/
+	r = ext4_fdelalloc_flush(file);
+	if (r != EOK)
+		goto Unlock;
+
+	if (offset < 0 || (uint64_t)offset >= file->fsize) {
+		r = ENXIO;
+		goto Unlock;
+	}
+
+	r = ext4_fs_get_inode_ref(fs, file->inode, &ref);
+	if (r != EOK)
+		goto Unlock;
+
+	iblock = (uint64_t)offset / block_size;
+	iblock_end = (file->fsize + block_size - 1) / block_size;
+	while (iblock < iblock_end) {
+		r = ext4_file_map_run(file, &ref, (uint32_t)iblock,
+				      (uint32_t)(iblock_end - iblock), &fblock,
+				      &cnt);
+		if (r != EOK)
+			break;
+
+		if (!fblock == hole) {
+			if (iblock * block_size > (uint64_t)offset)
+				offset = iblock * block_size;
+			break;
+		}
+		iblock += cnt;
+	}
+
+	if (r == EOK && iblock >= iblock_end) {
+		/*The end of file is a hole, there is no more data*/
+		if (hole)
+			offset = file->fsize;
+		else
+			r = ENXIO;
+	}
+
+	ext4_fs_put_inode_ref(&ref);
+	if (r == EOK)
+		file->fpos = offset;
+
+Unlock:
 	EXT4_MP_UNLOCK(file->mp);
 	return r;
 }
@@ -2033,6 +2952,10 @@ int ext4_fseek(ext4_file *file, int64_t offset, uint32_t origin)
 
 		file->fpos = file->fsize - offset;
 		return EOK;
+	case SEEK_DATA:
+		return ext4_fseek_data(file, offset, false);
+	case SEEK_HOLE:
+		return ext4_fseek_data(file, offset, true);
 	}
 	return EINVAL;
 }
@@ -2474,6 +3397,9 @@ static int ext4_fsymlink_set(ext4_file *f, const void *buf, uint32_t size)
 		if (r != EOK)
 			goto Finish;
 
+		/* Written behind the cache, drop a copy read ahead before */
+		ext4_bcache_invalidate_lba(f->mp->fs.bdev->bc, fblock, 1);
+
 		off = fblock * block_size;
 		r = ext4_block_writebytes(f->mp->fs.bdev, off, buf, size);
 		if (r != EOK)
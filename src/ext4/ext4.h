@@ -67,6 +67,14 @@ struct ext4_lock {
 
 /********************************FILE DESCRIPTOR*****************************/
 
+/**@brief   Cached block mapping of an open file: len logical blocks from
+ *          lblk are stored at pblk and on.*/
+struct ext4_file_map {
+	uint32_t lblk;
+	uint32_t len;
+	uint64_t pblk;
+};
+
 /**@brief   File descriptor. */
 typedef struct ext4_file {
 
@@ -84,6 +92,36 @@ typedef struct ext4_file {
 
 	/**@brief   Actual file position.*/
 	uint64_t fpos;
+
+	/**@brief   Delayed allocation buffer (ext4_mount_opts::delalloc_bytes).*/
+	uint8_t *da_buf;
+
+	/**@brief   Bytes in da_buf, they belong at file offset da_pos.*/
+	uint32_t da_len;
+	uint64_t da_pos;
+
+	/**@brief   Append stream mode (@ref ext4_fstream): da_buf size
+	 *          (0 - ext4_mount_opts::delalloc_bytes), write back interval
+	 *          and time of the last write back.*/
+	uint32_t st_bytes;
+	uint32_t st_interval_ms;
+	uint32_t st_time_us;
+
+#if CONFIG_EXT4_FILE_MAP_CACHE
+	/**@brief   Recently mapped extent runs (written blocks only).*/
+	struct ext4_file_map map[CONFIG_EXT4_FILE_MAP_CACHE];
+
+	/**@brief   Mount point map_gen the runs are valid for.*/
+	uint32_t map_gen;
+
+	/**@brief   Next run slot to replace.*/
+	uint32_t map_next;
+#endif
+
+#if CONFIG_BLOCK_DEV_READAHEAD
+	/**@brief   Readahead state of the reads through the block cache.*/
+	struct ext4_block_ra ra;
+#endif
 } ext4_file;
 
 /*****************************DIRECTORY DESCRIPTOR***************************/
@@ -143,6 +181,39 @@ int ext4_mount(const char *dev_name,
 	       const char *mount_point,
 	       bool read_only);
 
+/**@brief   Mount options (@ref ext4_mount_ex).*/
+struct ext4_mount_opts {
+	/**@brief   Mount as read-only mode.*/
+	bool read_only;
+
+	/**@brief   Block cache size in blocks
+	 *          (0 - use cache_bytes or CONFIG_BLOCK_DEV_CACHE_SIZE).*/
+	uint32_t cache_blocks;
+
+	/**@brief   Block cache memory budget in bytes (buffers and their
+	 *          descriptors), used when cache_blocks is 0.*/
+	uint32_t cache_bytes;
+
+	/**@brief   Delayed allocation: appends to each open file collect in
+	 *          a buffer of this many bytes and get their blocks in one
+	 *          run when it is written (0 - off). See @ref ext4_fflush.
+	 *          Appends held when the file is removed are dropped; flush
+	 *          before removing a file that is still open.*/
+	uint32_t delalloc_bytes;
+};
+
+/**@brief   Mount a block device with EXT4 partition to the mount point,
+ *          with per mount options.
+ *
+ * @param   dev_name Block device name (@ref ext4_device_register).
+ * @param   mount_point Mount point (see @ref ext4_mount).
+ * @param   opts Mount options (NULL - defaults, read-write).
+ *
+ * @return Standard error code */
+int ext4_mount_ex(const char *dev_name,
+		  const char *mount_point,
+		  const struct ext4_mount_opts *opts);
+
 /**@brief   Umount operation.
  *
  * @param   mount_pount Mount point.
@@ -205,6 +276,41 @@ struct ext4_mount_stats {
 int ext4_mount_point_stats(const char *mount_point,
 			   struct ext4_mount_stats *stats);
 
+/**@brief   Block cache info.*/
+struct ext4_cache_info {
+	uint32_t block_size;
+	uint32_t cache_blocks;
+	uint32_t ref_blocks;
+	uint32_t max_ref_blocks;
+};
+
+/**@brief   Get mount point block cache size and usage.
+ *
+ * @param   mount_pount Mount point.
+ * @param   info Block cache info.
+ *
+ * @return Standard error code. */
+int ext4_mount_point_cache_info(const char *mount_point,
+				struct ext4_cache_info *info);
+
+/**@brief   Get mount point block cache and device I/O statistics
+ *          (CONFIG_BLOCK_DEV_ENABLE_STATS). Counted since mount or
+ *          the last @ref ext4_mount_point_io_stats_reset.
+ *
+ * @param   mount_pount Mount point.
+ * @param   stats I/O statistics.
+ *
+ * @return Standard error code. */
+int ext4_mount_point_io_stats(const char *mount_point,
+			      struct ext4_io_stats *stats);
+
+/**@brief   Clear mount point I/O statistics.
+ *
+ * @param   mount_pount Mount point.
+ *
+ * @return Standard error code. */
+int ext4_mount_point_io_stats_reset(const char *mount_point);
+
 /**@brief   Setup OS lock routines.
  *
  * @param   mount_point Mount point.
@@ -312,7 +418,17 @@ int ext4_frename(const char *path, const char *new_path);
  * @return  Standard error code.*/
 int ext4_fopen(ext4_file *file, const char *path, const char *flags);
 
+/**@brief   Open flag of @ref ext4_fopen2: file data bypasses the block
+ *          cache. lwext4 private, above the libc O_ flags.*/
+#define EXT4_O_DIRECT 0x40000000
+
 /**@brief   Alternate file open function.
+ *
+ *  With EXT4_O_DIRECT the file data does not go through the block cache, so
+ *  that bulk transfers do not evict the cached metadata. Whole blocks
+ *  are moved between the caller buffer and the device, a partial block
+ *  that is not cached is read, patched and written back directly.
+ *  Appends are not held back by delayed allocation.
  *
  * @param   file  File handle.
  * @param   path  File path, has to start from mount point:/my_partition/file.
@@ -329,7 +445,10 @@ int ext4_fopen2(ext4_file *file, const char *path, int flags);
 int ext4_fclose(ext4_file *file);
 
 
-/**@brief   File truncate function.
+/**@brief   File truncate function. Blocks past the new size are freed,
+ *          also those preallocated past the end of file, so truncating
+ *          to the current size drops them (as on Linux). A larger size
+ *          does nothing.
  *
  * @param   file File handle.
  * @param   size New file size.
@@ -337,6 +456,37 @@ int ext4_fclose(ext4_file *file);
  * @return  Standard error code.*/
 int ext4_ftruncate(ext4_file *file, uint64_t size);
 
+/**@brief   @ref ext4_fallocate flag: do not change the file size. The
+ *          blocks past the end of file stay until the file is removed
+ *          or truncated, @ref ext4_ftruncate to its size frees them.*/
+#define EXT4_FALLOC_KEEP_SIZE 0x01
+
+/**@brief   Preallocate file space. Holes in the range get blocks as
+ *          unwritten extents, nothing is written to them. They read as
+ *          zeros until written. Extent mapped files only.
+ *
+ * @param   file   File handle.
+ * @param   offset First byte of the range.
+ * @param   len    Length of the range.
+ * @param   flags  0 - the file grows to cover the range,
+ *                 EXT4_FALLOC_KEEP_SIZE - the file size is not changed.
+ *
+ * @return  Standard error code.*/
+int ext4_fallocate(ext4_file *file, uint64_t offset, uint64_t len,
+		   int flags);
+
+/**@brief   Free the blocks of a range inside a file and leave a hole.
+ *          The range reads as zeros afterwards, the file size is not
+ *          changed. Parts of blocks at the ends of the range are zeroed.
+ *          Extent mapped files only.
+ *
+ * @param   file   File handle.
+ * @param   offset First byte of the range.
+ * @param   len    Length of the range.
+ *
+ * @return  Standard error code.*/
+int ext4_fpunch(ext4_file *file, uint64_t offset, uint64_t len);
+
 /**@brief   Read data from file.
  *
  * @param   file File handle.
@@ -357,6 +507,56 @@ int ext4_fread(ext4_file *file, void *buf, size_t size, size_t *rcnt);
  * @return  Standard error code.*/
 int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt);
 
+/**@brief   Write the appends held back by delayed allocation
+ *          (ext4_mount_opts::delalloc_bytes) to the file. Done by
+ *          @ref ext4_fclose, @ref ext4_fread, @ref ext4_ftruncate and
+ *          writes that do not append, too.
+ *
+ * @param   file File handle.
+ *
+ * @return  Standard error code.*/
+int ext4_fflush(ext4_file *file);
+
+/**@brief   Write back the cached changes of this file and nothing else:
+ *          its data blocks, its extent/indirect blocks, its inode table
+ *          block and the bitmaps and group descriptors its writes,
+ *          truncates, fallocates and punches touched. Blocks shared
+ *          with other files go, too. Directory entries do not, sync
+ *          the directory (or @ref ext4_cache_flush) for a new file.
+ *
+ * @param   file File handle.
+ *
+ * @return  Standard error code.*/
+int ext4_fsync(ext4_file *file);
+
+/**@brief   Like @ref ext4_fsync, but the inode table block is written
+ *          only if a write, truncate, fallocate or punch of the file
+ *          changed it (size or block map). Inode changes made by path
+ *          (mode, owner, times, xattrs) stay in the cache.
+ *
+ * @param   file File handle.
+ *
+ * @return  Standard error code.*/
+int ext4_fdatasync(ext4_file *file);
+
+/**@brief   Append stream mode, for files that grow by many small writes
+ *          (sensor logging). Appends collect in a buffer of bytes held
+ *          by the file handle, like delayed allocation but sized per
+ *          file and on whatever ext4_mount_opts::delalloc_bytes is. An
+ *          append costs a memcpy; the inode, block allocator and cache
+ *          are only touched when the buffer fills. In addition, the
+ *          first append after interval_ms since the last write back
+ *          does @ref ext4_fdatasync, so at most that much logging is
+ *          lost if the drive is pulled (needs CONFIG_BLOCK_DEV_TIME_US).
+ *
+ * @param   file File handle.
+ * @param   bytes Buffer size (0 - back to the mount point setting).
+ * @param   interval_ms Write back interval (0 - only on full buffer),
+ *          under 71 minutes, the microsecond clock wraps.
+ *
+ * @return  Standard error code.*/
+int ext4_fstream(ext4_file *file, uint32_t bytes, uint32_t interval_ms);
+
 /**@brief   File seek operation.
  *
  * @param   file File handle.
@@ -365,8 +565,13 @@ int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt);
  *              @ref SEEK_SET
  *              @ref SEEK_CUR
  *              @ref SEEK_END
+ *              @ref SEEK_DATA - first data at or after offset
+ *              @ref SEEK_HOLE - first hole at or after offset (the end
+ *                               of file counts as a hole)
+ *              Preallocated (unwritten) ranges are holes.
  *
- * @return  Standard error code.*/
+ * @return  Standard error code (ENXIO - offset at or past the end of
+ *          file, or no data after it for SEEK_DATA).*/
 int ext4_fseek(ext4_file *file, int64_t offset, uint32_t origin);
 
 /**@brief   Get file position.
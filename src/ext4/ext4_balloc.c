@@ -126,16 +126,21 @@ void ext4_balloc_set_bitmap_csum(struct ext4_sblock *sb,
 static bool
 ext4_balloc_verify_bitmap_csum(struct ext4_sblock *sb,
 			       struct ext4_bgroup *bg,
-			       void *bitmap __unused)
+			       struct ext4_block *b)
 {
 	int desc_size = ext4_sb_get_desc_size(sb);
-	uint32_t checksum = ext4_balloc_bitmap_csum(sb, bitmap);
-	uint16_t lo_checksum = to_le16(checksum & 0xFFFF),
-		 hi_checksum = to_le16(checksum >> 16);
 
 	if (!ext4_sb_feature_ro_com(sb, EXT4_FRO_COM_METADATA_CSUM))
 		return true;
 
+	/* The bitmap is verified once per read of its block */
+	if (ext4_bcache_test_verified(b->buf, EXT4_BCACHE_VERIFIED_BLOCK))
+		return true;
+
+	uint32_t checksum = ext4_balloc_bitmap_csum(sb, b->data);
+	uint16_t lo_checksum = to_le16(checksum & 0xFFFF),
+		 hi_checksum = to_le16(checksum >> 16);
+
 	if (bg->block_bitmap_csum_lo != lo_checksum)
 		return false;
 
@@ -143,6 +148,7 @@ ext4_balloc_verify_bitmap_csum(struct ext4_sblock *sb,
 		if (bg->block_bitmap_csum_hi != hi_checksum)
 			return false;
 
+	ext4_bcache_set_verified(b->buf, EXT4_BCACHE_VERIFIED_BLOCK);
 	return true;
 }
 #else
@@ -177,7 +183,7 @@ int ext4_balloc_free_block(struct ext4_inode_ref *inode_ref, ext4_fsblk_t baddr)
 		return rc;
 	}
 
-	if (!ext4_balloc_verify_bitmap_csum(sb, bg, bitmap_block.data)) {
+	if (!ext4_balloc_verify_bitmap_csum(sb, bg, &bitmap_block)) {
 		ext4_dbg(DEBUG_BALLOC,
 			DBG_WARN "Bitmap checksum failed."
 			"Group: %" PRIu32"\n",
@@ -186,7 +192,8 @@ int ext4_balloc_free_block(struct ext4_inode_ref *inode_ref, ext4_fsblk_t baddr)
 
 	/* Modify bitmap */
 	ext4_bmap_bit_clr(bitmap_block.data, index_in_group);
-	ext4_balloc_set_bitmap_csum(sb, bg, bitmap_block.data);
+	ext4_fs_set_block_bitmap_csum(&bg_ref, &bitmap_block,
+				      index_in_group, 1);
 	ext4_trans_set_block_dirty(bitmap_block.buf);
 
 	/* Release block with bitmap */
@@ -278,7 +285,7 @@ int ext4_balloc_free_blocks(struct ext4_inode_ref *inode_ref,
 			return rc;
 		}
 
-		if (!ext4_balloc_verify_bitmap_csum(sb, bg, blk.data)) {
+		if (!ext4_balloc_verify_bitmap_csum(sb, bg, &blk)) {
 			ext4_dbg(DEBUG_BALLOC,
 				DBG_WARN "Bitmap checksum failed."
 				"Group: %" PRIu32"\n",
@@ -292,7 +299,8 @@ int ext4_balloc_free_blocks(struct ext4_inode_ref *inode_ref,
 
 		/* Modify bitmap */
 		ext4_bmap_bits_free(blk.data, idx_in_bg_first, free_cnt);
-		ext4_balloc_set_bitmap_csum(sb, bg, blk.data);
+		ext4_fs_set_block_bitmap_csum(&bg_ref, &blk, idx_in_bg_first,
+					      free_cnt);
 		ext4_trans_set_block_dirty(blk.buf);
 
 		count -= free_cnt;
@@ -349,17 +357,52 @@ int ext4_balloc_free_blocks(struct ext4_inode_ref *inode_ref,
 	return rc;
 }
 
+/**@brief   Mark the free bit idx and as many free bits right after it as
+ *          possible (up to max bits, not past end) in use.
+ * @return  number of bits marked*/
+static uint32_t ext4_balloc_claim_run(uint8_t *bitmap, uint32_t idx,
+				      uint32_t end, uint32_t max)
+{
+	uint32_t cnt = 1;
+
+	ext4_bmap_bit_set(bitmap, idx);
+	while (cnt < max && idx + cnt < end &&
+	       ext4_bmap_is_bit_clr(bitmap, idx + cnt)) {
+		ext4_bmap_bit_set(bitmap, idx + cnt);
+		cnt++;
+	}
+	return cnt;
+}
+
 int ext4_balloc_alloc_block(struct ext4_inode_ref *inode_ref,
 			    ext4_fsblk_t goal,
 			    ext4_fsblk_t *fblock)
+{
+	uint32_t cnt;
+	return ext4_balloc_alloc_blocks(inode_ref, goal, 1, fblock, &cnt);
+}
+
+int ext4_balloc_alloc_blocks(struct ext4_inode_ref *inode_ref,
+			     ext4_fsblk_t goal, uint32_t max,
+			     ext4_fsblk_t *fblock, uint32_t *alloc_cnt)
 {
 	ext4_fsblk_t alloc = 0;
 	ext4_fsblk_t bmp_blk_adr;
 	uint32_t rel_blk_idx = 0;
+	uint32_t cnt = 0;
 	uint64_t free_blocks;
 	int r;
 	struct ext4_sblock *sb = &inode_ref->fs->sb;
 
+	ext4_assert(max);
+	*alloc_cnt = 0;
+
+	/* A goal off the file system (extrapolated back from an extent
+	 * near the disk start) starts at the first data block, as on Linux */
+	if (goal < ext4_get32(sb, first_data_block) ||
+	    goal >= ext4_sb_get_blocks_cnt(sb))
+		goal = ext4_get32(sb, first_data_block);
+
 	/* Load block group number for goal and relative index */
 	uint32_t bg_id = ext4_balloc_get_bgid_of_block(sb, goal);
 	uint32_t idx_in_bg = ext4_fs_addr_to_idx_bg(sb, goal);
@@ -399,18 +442,19 @@ int ext4_balloc_alloc_block(struct ext4_inode_ref *inode_ref,
 		return r;
 	}
 
-	if (!ext4_balloc_verify_bitmap_csum(sb, bg, b.data)) {
+	if (!ext4_balloc_verify_bitmap_csum(sb, bg, &b)) {
 		ext4_dbg(DEBUG_BALLOC,
 			DBG_WARN "Bitmap checksum failed."
 			"Group: %" PRIu32"\n",
 			bg_ref.index);
 	}
 
+	uint32_t blk_in_bg = ext4_blocks_in_group_cnt(sb, bg_id);
+
 	/* Check if goal is free */
 	if (ext4_bmap_is_bit_clr(b.data, idx_in_bg)) {
-		ext4_bmap_bit_set(b.data, idx_in_bg);
-		ext4_balloc_set_bitmap_csum(sb, bg_ref.block_group,
-					    b.data);
+		cnt = ext4_balloc_claim_run(b.data, idx_in_bg, blk_in_bg, max);
+		ext4_fs_set_block_bitmap_csum(&bg_ref, &b, idx_in_bg, cnt);
 		ext4_trans_set_block_dirty(b.buf);
 		r = ext4_block_set(inode_ref->fs->bdev, &b);
 		if (r != EOK) {
@@ -422,8 +466,6 @@ int ext4_balloc_alloc_block(struct ext4_inode_ref *inode_ref,
 		goto success;
 	}
 
-	uint32_t blk_in_bg = ext4_blocks_in_group_cnt(sb, bg_id);
-
 	uint32_t end_idx = (idx_in_bg + 63) & ~63;
 	if (end_idx > blk_in_bg)
 		end_idx = blk_in_bg;
@@ -432,9 +474,10 @@ int ext4_balloc_alloc_block(struct ext4_inode_ref *inode_ref,
 	uint32_t tmp_idx;
 	for (tmp_idx = idx_in_bg + 1; tmp_idx < end_idx; ++tmp_idx) {
 		if (ext4_bmap_is_bit_clr(b.data, tmp_idx)) {
-			ext4_bmap_bit_set(b.data, tmp_idx);
+			cnt = ext4_balloc_claim_run(b.data, tmp_idx, blk_in_bg,
+						    max);
 
-			ext4_balloc_set_bitmap_csum(sb, bg, b.data);
+			ext4_fs_set_block_bitmap_csum(&bg_ref, &b, tmp_idx, cnt);
 			ext4_trans_set_block_dirty(b.buf);
 			r = ext4_block_set(inode_ref->fs->bdev, &b);
 			if (r != EOK)
@@ -448,8 +491,8 @@ int ext4_balloc_alloc_block(struct ext4_inode_ref *inode_ref,
 	/* Find free bit in bitmap */
 	r = ext4_bmap_bit_find_clr(b.data, idx_in_bg, blk_in_bg, &rel_blk_idx);
 	if (r == EOK) {
-		ext4_bmap_bit_set(b.data, rel_blk_idx);
-		ext4_balloc_set_bitmap_csum(sb, bg_ref.block_group, b.data);
+		cnt = ext4_balloc_claim_run(b.data, rel_blk_idx, blk_in_bg, max);
+		ext4_fs_set_block_bitmap_csum(&bg_ref, &b, rel_blk_idx, cnt);
 		ext4_trans_set_block_dirty(b.buf);
 		r = ext4_block_set(inode_ref->fs->bdev, &b);
 		if (r != EOK)
@@ -497,7 +540,7 @@ goal_failed:
 			return r;
 		}
 
-		if (!ext4_balloc_verify_bitmap_csum(sb, bg, b.data)) {
+		if (!ext4_balloc_verify_bitmap_csum(sb, bg, &b)) {
 			ext4_dbg(DEBUG_BALLOC,
 				DBG_WARN "Bitmap checksum failed."
 				"Group: %" PRIu32"\n",
@@ -516,8 +559,10 @@ goal_failed:
 		r = ext4_bmap_bit_find_clr(b.data, idx_in_bg, blk_in_bg,
 				&rel_blk_idx);
 		if (r == EOK) {
-			ext4_bmap_bit_set(b.data, rel_blk_idx);
-			ext4_balloc_set_bitmap_csum(sb, bg, b.data);
+			cnt = ext4_balloc_claim_run(b.data, rel_blk_idx,
+						    blk_in_bg, max);
+			ext4_fs_set_block_bitmap_csum(&bg_ref, &b, rel_blk_idx,
+						      cnt);
 			ext4_trans_set_block_dirty(b.buf);
 			r = ext4_block_set(inode_ref->fs->bdev, &b);
 			if (r != EOK) {
@@ -556,25 +601,26 @@ success:
 
 	/* Update superblock free blocks count */
 	uint64_t sb_free_blocks = ext4_sb_get_free_blocks_cnt(sb);
-	sb_free_blocks--;
+	sb_free_blocks -= cnt;
 	ext4_sb_set_free_blocks_cnt(sb, sb_free_blocks);
 
 	/* Update inode blocks (different block size!) count */
 	uint64_t ino_blocks = ext4_inode_get_blocks_count(sb, inode_ref->inode);
-	ino_blocks += block_size / EXT4_INODE_BLOCK_SIZE;
+	ino_blocks += (uint64_t)cnt * (block_size / EXT4_INODE_BLOCK_SIZE);
 	ext4_inode_set_blocks_count(sb, inode_ref->inode, ino_blocks);
 	inode_ref->dirty = true;
 
 	/* Update block group free blocks count */
 
 	uint32_t fb_cnt = ext4_bg_get_free_blocks_count(bg_ref.block_group, sb);
-	fb_cnt--;
+	fb_cnt -= cnt;
 	ext4_bg_set_free_blocks_count(bg_ref.block_group, sb, fb_cnt);
 
 	bg_ref.dirty = true;
 	r = ext4_fs_put_block_group_ref(&bg_ref);
 
 	*fblock = alloc;
+	*alloc_cnt = cnt;
 	return r;
 }
 
@@ -607,7 +653,7 @@ int ext4_balloc_try_alloc_block(struct ext4_inode_ref *inode_ref,
 		return rc;
 	}
 
-	if (!ext4_balloc_verify_bitmap_csum(sb, bg_ref.block_group, b.data)) {
+	if (!ext4_balloc_verify_bitmap_csum(sb, bg_ref.block_group, &b)) {
 		ext4_dbg(DEBUG_BALLOC,
 			DBG_WARN "Bitmap checksum failed."
 			"Group: %" PRIu32"\n",
@@ -620,7 +666,7 @@ int ext4_balloc_try_alloc_block(struct ext4_inode_ref *inode_ref,
 	/* Allocate block if possible */
 	if (*free) {
 		ext4_bmap_bit_set(b.data, index_in_group);
-		ext4_balloc_set_bitmap_csum(sb, bg_ref.block_group, b.data);
+		ext4_fs_set_block_bitmap_csum(&bg_ref, &b, index_in_group, 1);
 		ext4_trans_set_block_dirty(b.buf);
 	}
 
@@ -102,6 +102,20 @@ int ext4_balloc_alloc_block(struct ext4_inode_ref *inode_ref,
 			    ext4_fsblk_t goal,
 			    ext4_fsblk_t *baddr);
 
+/**@brief   Allocate a run of consecutive blocks with one bitmap, group
+ *          descriptor and superblock update. The run starts where
+ *          @ref ext4_balloc_alloc_block would allocate and ends at the
+ *          first used block, the end of the group or max blocks.
+ * @param   inode_ref inode reference
+ * @param   goal
+ * @param   max most blocks to allocate (at least 1)
+ * @param   baddr first allocated block address
+ * @param   alloc_cnt number of allocated blocks
+ * @return  standard error code*/
+int ext4_balloc_alloc_blocks(struct ext4_inode_ref *inode_ref,
+			     ext4_fsblk_t goal, uint32_t max,
+			     ext4_fsblk_t *baddr, uint32_t *alloc_cnt);
+
 /**@brief   Try allocate selected block.
  * @param   inode_ref inode reference
  * @param   baddr block address to allocate
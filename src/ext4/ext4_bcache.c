@@ -44,6 +44,7 @@
 #include <string.h>
 #include <stdlib.h>
 
+#if !CONFIG_BLOCK_DEV_CACHE_HASH
 static int ext4_bcache_lba_compare(struct ext4_buf *a, struct ext4_buf *b)
 {
 	 if (a->lba > b->lba)
@@ -66,6 +67,7 @@ RB_GENERATE_INTERNAL(ext4_buf_lba, ext4_buf, lba_node,
 		     ext4_bcache_lba_compare, static inline)
 RB_GENERATE_INTERNAL(ext4_buf_lru, ext4_buf, lru_node,
 		     ext4_bcache_lru_compare, static inline)
+#endif
 
 int ext4_bcache_init_dynamic(struct ext4_bcache *bc, uint32_t cnt,
 			     uint32_t itemsize)
@@ -79,20 +81,85 @@ int ext4_bcache_init_dynamic(struct ext4_bcache *bc, uint32_t cnt,
 	bc->ref_blocks = 0;
 	bc->max_ref_blocks = 0;
 
+#if CONFIG_BLOCK_DEV_CACHE_HASH
+	uint32_t hash_size = 16;
+
+	/* Keep the table at most half full while the cache holds cnt
+	 * buffers. It grows on demand if it gets past 3/4.*/
+	while (hash_size < 2 * cnt)
+		hash_size <<= 1;
+
+	bc->hash_tab = ext4_calloc(hash_size, sizeof(struct ext4_buf *));
+	if (!bc->hash_tab)
+		return ENOMEM;
+
+	bc->hash_mask = hash_size - 1;
+	TAILQ_INIT(&bc->lru_list);
+#endif
+
+#if CONFIG_BLOCK_DEV_CACHE_POOL
+	uint32_t i;
+
+	bc->pool_bufs = ext4_calloc(cnt, sizeof(struct ext4_buf));
+	bc->pool_data = ext4_malloc((size_t)cnt * itemsize);
+	if (!bc->pool_bufs || !bc->pool_data) {
+		ext4_free(bc->pool_bufs);
+		ext4_free(bc->pool_data);
+#if CONFIG_BLOCK_DEV_CACHE_HASH
+		ext4_free(bc->hash_tab);
+#endif
+		memset(bc, 0, sizeof(struct ext4_bcache));
+		return ENOMEM;
+	}
+
+	SLIST_INIT(&bc->free_list);
+	for (i = cnt; i > 0; i--) {
+		struct ext4_buf *buf = &bc->pool_bufs[i - 1];
+		buf->data = bc->pool_data + (size_t)(i - 1) * itemsize;
+		SLIST_INSERT_HEAD(&bc->free_list, buf, free_node);
+	}
+#endif
 	return EOK;
 }
 
 void ext4_bcache_cleanup(struct ext4_bcache *bc)
 {
+#if CONFIG_BLOCK_DEV_CACHE_HASH
+	uint32_t i = 0;
+	struct ext4_buf *buf;
+
+	/* Dropping a buffer may shift a later entry of the same probe run
+	 * into slot i, so only move on once the slot is empty.*/
+	while (i <= bc->hash_mask) {
+		buf = bc->hash_tab[i];
+		if (!buf) {
+			i++;
+			continue;
+		}
+		ext4_block_flush_buf(bc->bdev, buf);
+		ext4_bcache_drop_buf(bc, buf);
+	}
+#else
 	struct ext4_buf *buf, *tmp;
 	RB_FOREACH_SAFE(buf, ext4_buf_lba, &bc->lba_root, tmp) {
 		ext4_block_flush_buf(bc->bdev, buf);
 		ext4_bcache_drop_buf(bc, buf);
 	}
+#endif
 }
 
 int ext4_bcache_fini_dynamic(struct ext4_bcache *bc)
 {
+#if CONFIG_BLOCK_DEV_CACHE_HASH
+	ext4_free(bc->hash_tab);
+#endif
+#if CONFIG_BLOCK_DEV_CACHE_POOL
+	ext4_free(bc->pool_bufs);
+	ext4_free(bc->pool_data);
+#endif
+#if CONFIG_BLOCK_DEV_GATHER_SIZE
+	ext4_free(bc->gather_buf);
+#endif
 	memset(bc, 0, sizeof(struct ext4_bcache));
 	return EOK;
 }
@@ -107,6 +174,12 @@ int ext4_bcache_fini_dynamic(struct ext4_bcache *bc)
  *  Bcache also maintains another RB-Tree(lru_root) right now, where
  *  buffers are sorted by their LRU id.
  *
+ *  With CONFIG_BLOCK_DEV_CACHE_HASH the LBA index is an open addressed
+ *  hash table (hash_tab, linear probing, backward shift deletion) and
+ *  the LRU index is a TAILQ (lru_list). A buffer is appended to the tail
+ *  when its last reference is released, so the head is always the least
+ *  recently used one. Lookup, touch and eviction are all O(1).
+ *
  *  A singly-linked list is used to track those dirty buffers which are
  *  ready to be flushed. (Those buffers which are dirty but also referenced
  *  are not considered ready to be flushed.)
@@ -114,13 +187,37 @@ int ext4_bcache_fini_dynamic(struct ext4_bcache *bc)
  *  When a buffer is not referenced, it will be stored in both lba_root
  *  and lru_root, while it will only be stored in lba_root when it is
  *  referenced.
+ *
+ *  With CONFIG_BLOCK_DEV_CACHE_POOL the descriptors and data of the first
+ *  cnt buffers come from arrays allocated by ext4_bcache_init_dynamic and
+ *  are recycled through free_list. Only when every pool buffer is
+ *  referenced at the same time does a miss fall back to the heap.
  */
 
+#if CONFIG_BLOCK_DEV_CACHE_POOL
+static bool ext4_buf_in_pool(struct ext4_bcache *bc, struct ext4_buf *buf)
+{
+	return buf >= bc->pool_bufs && buf < bc->pool_bufs + bc->cnt;
+}
+#endif
+
 static struct ext4_buf *
 ext4_buf_alloc(struct ext4_bcache *bc, uint64_t lba)
 {
 	void *data;
 	struct ext4_buf *buf;
+#if CONFIG_BLOCK_DEV_CACHE_POOL
+	buf = SLIST_FIRST(&bc->free_list);
+	if (buf) {
+		SLIST_REMOVE_HEAD(&bc->free_list, free_node);
+		data = buf->data;
+		memset(buf, 0, sizeof(struct ext4_buf));
+		buf->lba = lba;
+		buf->data = data;
+		buf->bc = bc;
+		return buf;
+	}
+#endif
 	data = ext4_malloc(bc->itemsize);
 	if (!data)
 		return NULL;
@@ -139,23 +236,209 @@ ext4_buf_alloc(struct ext4_bcache *bc, uint64_t lba)
 
 static void ext4_buf_free(struct ext4_buf *buf)
 {
+#if CONFIG_BLOCK_DEV_CACHE_POOL
+	struct ext4_bcache *bc = buf->bc;
+	if (ext4_buf_in_pool(bc, buf)) {
+		SLIST_INSERT_HEAD(&bc->free_list, buf, free_node);
+		return;
+	}
+#endif
 	ext4_free(buf->data);
 	ext4_free(buf);
 }
 
-static struct ext4_buf *
-ext4_buf_lookup(struct ext4_bcache *bc, uint64_t lba)
+#if CONFIG_BLOCK_DEV_CACHE_HASH
+static inline uint32_t ext4_buf_hash(struct ext4_bcache *bc, uint64_t lba)
+{
+	/* Multiplicative (Fibonacci) hash, neighbouring LBAs spread out. */
+	return (uint32_t)((lba * 0x9E3779B97F4A7C15ull) >> 32) & bc->hash_mask;
+}
+
+static void ext4_buf_hash_place(struct ext4_bcache *bc, struct ext4_buf *buf)
+{
+	uint32_t i = ext4_buf_hash(bc, buf->lba);
+
+	while (bc->hash_tab[i])
+		i = (i + 1) & bc->hash_mask;
+
+	bc->hash_tab[i] = buf;
+}
+
+static int ext4_buf_hash_grow(struct ext4_bcache *bc)
+{
+	uint32_t i, size = bc->hash_mask + 1;
+	struct ext4_buf **old = bc->hash_tab;
+	struct ext4_buf **tab;
+
+	tab = ext4_calloc(2 * size, sizeof(struct ext4_buf *));
+	if (!tab)
+		return ENOMEM;
+
+	bc->hash_tab = tab;
+	bc->hash_mask = 2 * size - 1;
+	for (i = 0; i < size; i++)
+		if (old[i])
+			ext4_buf_hash_place(bc, old[i]);
+
+	ext4_free(old);
+	return EOK;
+}
+#endif
+
+static int ext4_buf_lba_insert(struct ext4_bcache *bc, struct ext4_buf *buf)
 {
+#if CONFIG_BLOCK_DEV_CACHE_HASH
+	/* The cache can go past cnt buffers when all of them are
+	 * referenced, keep the load factor below 3/4.*/
+	if ((uint64_t)(bc->ref_blocks + 1) * 4 > (uint64_t)(bc->hash_mask + 1) * 3) {
+		int r = ext4_buf_hash_grow(bc);
+		if (r != EOK)
+			return r;
+	}
+
+	ext4_buf_hash_place(bc, buf);
+#else
+	RB_INSERT(ext4_buf_lba, &bc->lba_root, buf);
+#endif
+	return EOK;
+}
+
+static void ext4_buf_lba_remove(struct ext4_bcache *bc, struct ext4_buf *buf)
+{
+#if CONFIG_BLOCK_DEV_CACHE_HASH
+	uint32_t i, j, k;
+
+	i = ext4_buf_hash(bc, buf->lba);
+	while (bc->hash_tab[i] != buf)
+		i = (i + 1) & bc->hash_mask;
+
+	/* Backward shift: pull later entries of the probe run into the
+	 * hole unless their home slot lies cyclically in (i, j].*/
+	j = i;
+	for (;;) {
+		j = (j + 1) & bc->hash_mask;
+		if (!bc->hash_tab[j])
+			break;
+
+		k = ext4_buf_hash(bc, bc->hash_tab[j]->lba);
+		if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+
+		bc->hash_tab[i] = bc->hash_tab[j];
+		i = j;
+	}
+	bc->hash_tab[i] = NULL;
+#else
+	RB_REMOVE(ext4_buf_lba, &bc->lba_root, buf);
+#endif
+}
+
+struct ext4_buf *ext4_buf_lookup(struct ext4_bcache *bc, uint64_t lba)
+{
+#if CONFIG_BLOCK_DEV_CACHE_HASH
+	struct ext4_buf *buf;
+	uint32_t i = ext4_buf_hash(bc, lba);
+
+	while ((buf = bc->hash_tab[i]) != NULL) {
+		if (buf->lba == lba)
+			return buf;
+		i = (i + 1) & bc->hash_mask;
+	}
+	return NULL;
+#else
 	struct ext4_buf tmp = {
 		.lba = lba
 	};
 
 	return RB_FIND(ext4_buf_lba, &bc->lba_root, &tmp);
+#endif
+}
+
+static void ext4_buf_lru_insert(struct ext4_bcache *bc, struct ext4_buf *buf)
+{
+#if CONFIG_BLOCK_DEV_CACHE_HASH
+	TAILQ_INSERT_TAIL(&bc->lru_list, buf, lru_node);
+#else
+	RB_INSERT(ext4_buf_lru, &bc->lru_root, buf);
+#endif
+}
+
+static void ext4_buf_lru_remove(struct ext4_bcache *bc, struct ext4_buf *buf)
+{
+#if CONFIG_BLOCK_DEV_CACHE_HASH
+	TAILQ_REMOVE(&bc->lru_list, buf, lru_node);
+#else
+	RB_REMOVE(ext4_buf_lru, &bc->lru_root, buf);
+#endif
 }
 
 struct ext4_buf *ext4_buf_lowest_lru(struct ext4_bcache *bc)
 {
+#if CONFIG_BLOCK_DEV_CACHE_HASH
+	return TAILQ_FIRST(&bc->lru_list);
+#else
 	return RB_MIN(ext4_buf_lru, &bc->lru_root);
+#endif
+}
+
+void ext4_bcache_sort_dirty(struct ext4_bcache *bc)
+{
+	struct ext4_buf *list = SLIST_FIRST(&bc->dirty_list);
+	struct ext4_buf *p, *q, *e, *tail;
+	uint32_t insize = 1, merges, psize, qsize;
+
+	if (!list)
+		return;
+
+	/* Bottom up merge sort of the list in place, no allocations. */
+	for (;;) {
+		p = list;
+		list = NULL;
+		tail = NULL;
+		merges = 0;
+
+		while (p) {
+			merges++;
+			q = p;
+			for (psize = 0; psize < insize && q; psize++)
+				q = SLIST_NEXT(q, dirty_node);
+
+			qsize = insize;
+			while (psize || (qsize && q)) {
+				if (!psize || (qsize && q && q->lba < p->lba)) {
+					e = q;
+					q = SLIST_NEXT(q, dirty_node);
+					qsize--;
+				} else {
+					e = p;
+					p = SLIST_NEXT(p, dirty_node);
+					psize--;
+				}
+
+				if (tail)
+					SLIST_NEXT(tail, dirty_node) = e;
+				else
+					list = e;
+				tail = e;
+			}
+			p = q;
+		}
+		SLIST_NEXT(tail, dirty_node) = NULL;
+
+		if (merges <= 1)
+			break;
+		insize *= 2;
+	}
+
+	SLIST_FIRST(&bc->dirty_list) = list;
+}
+
+void ext4_bcache_csum_update_dirty(struct ext4_bcache *bc)
+{
+	struct ext4_buf *buf;
+
+	SLIST_FOREACH(buf, &bc->dirty_list, dirty_node)
+		ext4_bcache_csum_update(buf);
 }
 
 void ext4_bcache_drop_buf(struct ext4_bcache *bc, struct ext4_buf *buf)
@@ -166,9 +449,9 @@ void ext4_bcache_drop_buf(struct ext4_bcache *bc, struct ext4_buf *buf)
 				"lba: %" PRIu64 ", refctr: %" PRIu32 "\n",
 				buf->lba, buf->refctr);
 	} else
-		RB_REMOVE(ext4_buf_lru, &bc->lru_root, buf);
+		ext4_buf_lru_remove(bc, buf);
 
-	RB_REMOVE(ext4_buf_lba, &bc->lba_root, buf);
+	ext4_buf_lba_remove(bc, buf);
 
 	/*Forcibly drop dirty buffer.*/
 	if (ext4_bcache_test_flag(buf, BC_DIRTY))
@@ -196,13 +479,39 @@ void ext4_bcache_invalidate_lba(struct ext4_bcache *bc,
 				uint32_t cnt)
 {
 	uint64_t end = from + cnt - 1;
-	struct ext4_buf *tmp = ext4_buf_lookup(bc, from), *buf;
+#if CONFIG_BLOCK_DEV_CACHE_HASH
+	struct ext4_buf *buf;
+	uint32_t i;
+
+	/* Probe the range block by block unless scanning the whole table
+	 * is cheaper. Invalidation does not remove entries.*/
+	if (cnt <= bc->hash_mask) {
+		for (; from <= end; from++) {
+			buf = ext4_buf_lookup(bc, from);
+			if (buf)
+				ext4_bcache_invalidate_buf(bc, buf);
+		}
+		return;
+	}
+
+	for (i = 0; i <= bc->hash_mask; i++) {
+		buf = bc->hash_tab[i];
+		if (buf && buf->lba >= from && buf->lba <= end)
+			ext4_bcache_invalidate_buf(bc, buf);
+	}
+#else
+	struct ext4_buf key = {
+		.lba = from
+	};
+	/* First cached buffer at or after from, which need not be cached.*/
+	struct ext4_buf *tmp = RB_NFIND(ext4_buf_lba, &bc->lba_root, &key), *buf;
 	RB_FOREACH_FROM(buf, ext4_buf_lba, tmp) {
 		if (buf->lba > end)
 			break;
 
 		ext4_bcache_invalidate_buf(bc, buf);
 	}
+#endif
 }
 
 struct ext4_buf *
@@ -216,7 +525,7 @@ ext4_bcache_find_get(struct ext4_bcache *bc, struct ext4_block *b,
 			/* Assign new value to LRU id and increment LRU counter
 			 * by 1*/
 			buf->lru_id = ++bc->lru_ctr;
-			RB_REMOVE(ext4_buf_lru, &bc->lru_root, buf);
+			ext4_buf_lru_remove(bc, buf);
 			if (ext4_bcache_test_flag(buf, BC_DIRTY))
 				ext4_bcache_remove_dirty_node(bc, buf);
 
@@ -246,7 +555,10 @@ int ext4_bcache_alloc(struct ext4_bcache *bc, struct ext4_block *b,
 	if (!buf)
 		return ENOMEM;
 
-	RB_INSERT(ext4_buf_lba, &bc->lba_root, buf);
+	if (ext4_buf_lba_insert(bc, buf) != EOK) {
+		ext4_buf_free(buf);
+		return ENOMEM;
+	}
 	/* One more buffer in bcache now. :-) */
 	bc->ref_blocks++;
 
@@ -287,7 +599,7 @@ int ext4_bcache_free(struct ext4_bcache *bc, struct ext4_block *b)
 
 	/* We are the last one touching this buffer, do the cleanups. */
 	if (!buf->refctr) {
-		RB_INSERT(ext4_buf_lru, &bc->lru_root, buf);
+		ext4_buf_lru_insert(bc, buf);
 		/* This buffer is ready to be flushed. */
 		if (ext4_bcache_test_flag(buf, BC_DIRTY) &&
 		    ext4_bcache_test_flag(buf, BC_UPTODATE)) {
@@ -45,6 +45,7 @@ extern "C" {
 
 #include "stdint.h"
 #include "stdbool.h"
+#include "stddef.h"
 #include "misc/tree.h"
 #include "misc/queue.h"
 
@@ -91,15 +92,33 @@ struct ext4_buf {
 	/**@brief   Whether or not buffer is on dirty list.*/
 	bool on_dirty_list;
 
+	/**@brief   Inode the buffer was dirtied for (valid while BC_DIRTY,
+	 *          see ext4_bcache::owner).*/
+	uint32_t owner;
+
+	/**@brief   Checksums verified since the block was read, one bit per
+	 *          checksummed unit (see ext4_bcache_test_verified).*/
+	uint32_t verified;
+
+#if CONFIG_BLOCK_DEV_CACHE_HASH
+	/**@brief   LRU list node*/
+	TAILQ_ENTRY(ext4_buf) lru_node;
+#else
 	/**@brief   LBA tree node*/
 	RB_ENTRY(ext4_buf) lba_node;
 
 	/**@brief   LRU tree node*/
 	RB_ENTRY(ext4_buf) lru_node;
+#endif
 
 	/**@brief   Dirty list node*/
 	SLIST_ENTRY(ext4_buf) dirty_node;
 
+#if CONFIG_BLOCK_DEV_CACHE_POOL
+	/**@brief   Free list node (pool buffers only)*/
+	SLIST_ENTRY(ext4_buf) free_node;
+#endif
+
 	/**@brief   Callback routine after a disk-write operation.
 	 * @param   bc block cache descriptor
 	 * @param   buf buffer descriptor
@@ -112,6 +131,23 @@ struct ext4_buf {
 
 	/**@brief   argument passed to end_write() callback.*/
 	void *end_write_arg;
+
+	/**@brief   Deferred checksum update, run once before the buffer
+	 *          is written back (see ext4_bcache_csum_update).
+	 * @param   buf buffer descriptor
+	 * @param   arg argument passed to this routine*/
+	void (*csum_pending)(struct ext4_buf *buf, void *arg);
+
+	/**@brief   argument passed to csum_pending() callback.*/
+	void *csum_pending_arg;
+
+	/**@brief   csum_pending() callback data: the group of a bitmap, the
+	 *          checksum seed of a directory block or the first inode of
+	 *          an inode table block.*/
+	uint32_t csum_id;
+
+	/**@brief   Inode slots with a pending checksum (inode table blocks).*/
+	uint32_t csum_units;
 };
 
 /**@brief   Block cache descriptor*/
@@ -138,14 +174,47 @@ struct ext4_bcache {
 	/**@brief   The cache should not be shaked */
 	bool dont_shake;
 
+	/**@brief   Inode of the file operation in progress (0 - none).
+	 *          Buffers dirtied meanwhile are tagged with it, so that
+	 *          a single file can be written back on its own.*/
+	uint32_t owner;
+
+#if CONFIG_BLOCK_DEV_CACHE_HASH
+	/**@brief   Open addressed (linear probing) table holding all bufs*/
+	struct ext4_buf **hash_tab;
+
+	/**@brief   Hash table size - 1 (size is a power of 2)*/
+	uint32_t hash_mask;
+
+	/**@brief   A list holding unreferenced bufs, least recently used
+	 *          first*/
+	TAILQ_HEAD(ext4_buf_lru, ext4_buf) lru_list;
+#else
 	/**@brief   A tree holding all bufs*/
 	RB_HEAD(ext4_buf_lba, ext4_buf) lba_root;
 
 	/**@brief   A tree holding unreferenced bufs*/
 	RB_HEAD(ext4_buf_lru, ext4_buf) lru_root;
+#endif
 
 	/**@brief   A singly-linked list holding dirty buffers*/
 	SLIST_HEAD(ext4_buf_dirty, ext4_buf) dirty_list;
+
+#if CONFIG_BLOCK_DEV_GATHER_SIZE
+	/**@brief   Write back gather buffer (allocated on first use)*/
+	uint8_t *gather_buf;
+#endif
+
+#if CONFIG_BLOCK_DEV_CACHE_POOL
+	/**@brief   Preallocated buffer descriptors (cnt items)*/
+	struct ext4_buf *pool_bufs;
+
+	/**@brief   Preallocated data area (cnt * itemsize bytes)*/
+	uint8_t *pool_data;
+
+	/**@brief   A singly-linked list holding unused pool buffers*/
+	SLIST_HEAD(ext4_buf_free, ext4_buf) free_list;
+#endif
 };
 
 /**@brief buffer state bits
@@ -173,7 +242,17 @@ enum bcache_state_bits {
 #define ext4_bcache_test_flag(buf, b)    \
 	(((buf)->flags & (1 << (b))) >> (b))
 
+/**@brief   ext4_buf::owner of a buffer dirtied by more than one inode.*/
+#define EXT4_BCACHE_OWNER_SHARED 0xFFFFFFFF
+
 static inline void ext4_bcache_set_dirty(struct ext4_buf *buf) {
+	uint32_t owner = buf->bc->owner;
+
+	if (!ext4_bcache_test_flag(buf, BC_DIRTY) || !buf->owner)
+		buf->owner = owner;
+	else if (owner && buf->owner != owner)
+		buf->owner = EXT4_BCACHE_OWNER_SHARED;
+
 	ext4_bcache_set_flag(buf, BC_UPTODATE);
 	ext4_bcache_set_flag(buf, BC_DIRTY);
 }
@@ -181,6 +260,51 @@ static inline void ext4_bcache_set_dirty(struct ext4_buf *buf) {
 static inline void ext4_bcache_clear_dirty(struct ext4_buf *buf) {
 	ext4_bcache_clear_flag(buf, BC_UPTODATE);
 	ext4_bcache_clear_flag(buf, BC_DIRTY);
+	buf->verified = 0;
+	buf->csum_pending = NULL;
+	buf->csum_units = 0;
+}
+
+/**@brief   ext4_buf::verified unit of a block with a single checksum.*/
+#define EXT4_BCACHE_VERIFIED_BLOCK 0
+
+/**@brief   Test whether a checksummed unit of the buffer (the whole block,
+ *          or an inode slot of an inode table block) has been verified
+ *          since it was read. Units past 31 are never remembered.*/
+static inline bool ext4_bcache_test_verified(struct ext4_buf *buf,
+					     uint32_t unit) {
+	return unit < 32 && (buf->verified & (UINT32_C(1) << unit));
+}
+
+/**@brief   Remember a successful checksum verification of a unit.*/
+static inline void ext4_bcache_set_verified(struct ext4_buf *buf,
+					    uint32_t unit) {
+	if (unit < 32)
+		buf->verified |= UINT32_C(1) << unit;
+}
+
+/**@brief   Defer a checksum update of a dirty buffer to its write back.
+ *          The content of the buffer is ours, so a later read of the
+ *          checksummed unit must not verify it against the stale
+ *          checksum.*/
+static inline void
+ext4_bcache_set_csum_pending(struct ext4_buf *buf,
+			     void (*csum)(struct ext4_buf *buf, void *arg),
+			     void *arg, uint32_t id, uint32_t unit) {
+	buf->csum_pending = csum;
+	buf->csum_pending_arg = arg;
+	buf->csum_id = id;
+	ext4_bcache_set_verified(buf, unit);
+}
+
+/**@brief   Run the deferred checksum update of a buffer, if any.*/
+static inline void ext4_bcache_csum_update(struct ext4_buf *buf) {
+	void (*csum)(struct ext4_buf *buf, void *arg) = buf->csum_pending;
+
+	if (csum) {
+		buf->csum_pending = NULL;
+		csum(buf, buf->csum_pending_arg);
+	}
 }
 
 /**@brief   Increment reference counter of buf by 1.*/
@@ -231,9 +355,26 @@ int ext4_bcache_fini_dynamic(struct ext4_bcache *bc);
 
 /**@brief   Get a buffer with the lowest LRU counter in bcache.
  * @param   bc block cache descriptor
- * @return  buffer with the lowest LRU counter*/
+ * @return  buffer with the lowest LRU counter
+ *          (NULL if every buffer is referenced)*/
 struct ext4_buf *ext4_buf_lowest_lru(struct ext4_bcache *bc);
 
+/**@brief   Find a buffer in bcache without referencing it.
+ * @param   bc block cache descriptor
+ * @param   lba logical block address
+ * @return  buffer (NULL if block is not cached)*/
+struct ext4_buf *ext4_buf_lookup(struct ext4_bcache *bc, uint64_t lba);
+
+/**@brief   Sort dirty list by LBA (ascending), so that write back can
+ *          merge consecutive blocks.
+ * @param   bc block cache descriptor*/
+void ext4_bcache_sort_dirty(struct ext4_bcache *bc);
+
+/**@brief   Run the deferred checksum updates of the buffers on the
+ *          dirty list.
+ * @param   bc block cache descriptor*/
+void ext4_bcache_csum_update_dirty(struct ext4_bcache *bc);
+
 /**@brief   Drop unreferenced buffer from bcache.
  * @param   bc block cache descriptor
  * @param   buf buffer*/
@@ -33,7 +33,9 @@
  * @file  ext4_blockdev.c
  * @brief Block device module.
  */
+#ifdef ARDUINO
 #include "Arduino.h"
+#endif
 #include "ext4_config.h"
 #include "ext4_types.h"
 #include "ext4_misc.h"
@@ -47,6 +49,41 @@
 #include <string.h>
 #include <stdlib.h>
 
+/* Blocks read ahead are staged in the gather buffer */
+#define EXT4_BLOCK_READAHEAD \
+	(CONFIG_BLOCK_DEV_READAHEAD && CONFIG_BLOCK_DEV_GATHER_SIZE)
+
+#if CONFIG_BLOCK_DEV_ENABLE_STATS
+#define ext4_bdev_stat_add(bdev, field, v) ((bdev)->stats.field += (v))
+#else
+#define ext4_bdev_stat_add(bdev, field, v) ((void)(bdev), (void)(v))
+#endif
+
+/**@brief   Account one device transfer started at time stamp t0.*/
+static void ext4_bdev_stat_io(struct ext4_blockdev *bdev, bool write,
+			      uint32_t blk_cnt, uint32_t t0)
+{
+#if CONFIG_BLOCK_DEV_ENABLE_STATS
+	uint64_t bytes = (uint64_t)blk_cnt * bdev->bdif->ph_bsize;
+	uint32_t t = t0 ? (uint32_t)(CONFIG_BLOCK_DEV_TIME_US() - t0) : 0;
+
+	if (write) {
+		bdev->stats.writes++;
+		bdev->stats.write_bytes += bytes;
+		bdev->stats.write_time_us += t;
+	} else {
+		bdev->stats.reads++;
+		bdev->stats.read_bytes += bytes;
+		bdev->stats.read_time_us += t;
+	}
+#else
+	(void)bdev;
+	(void)write;
+	(void)blk_cnt;
+	(void)t0;
+#endif
+}
+
 static void ext4_bdif_lock(struct ext4_blockdev *bdev)
 {
 	if (!bdev->bdif->lock)
@@ -65,26 +102,98 @@ static void ext4_bdif_unlock(struct ext4_blockdev *bdev)
 	ext4_assert(r == EOK);
 }
 
+/**@brief   Wait for the oldest submitted transfer, keep its error.*/
+static void ext4_bdif_wait(struct ext4_blockdev *bdev)
+{
+	uint32_t t0 = CONFIG_BLOCK_DEV_TIME_US();
+
+	ext4_bdif_lock(bdev);
+	int r = bdev->bdif->wait(bdev);
+	bool write = bdev->bdif->ph_inflight_wr & 1;
+	bdev->bdif->ph_inflight_wr >>= 1;
+	bdev->bdif->ph_inflight--;
+	ext4_bdif_unlock(bdev);
+
+	/* Transfers and bytes are counted at submit, only the time the
+	 * caller had to wait for the device is added here.*/
+	if (t0) {
+		uint32_t t = (uint32_t)(CONFIG_BLOCK_DEV_TIME_US() - t0);
+		if (write)
+			ext4_bdev_stat_add(bdev, write_time_us, t);
+		else
+			ext4_bdev_stat_add(bdev, read_time_us, t);
+	}
+
+	if (r != EOK && bdev->bdif->ph_async_err == EOK)
+		bdev->bdif->ph_async_err = r;
+}
+
+/**@brief   Complete all submitted transfers before a synchronous one.*/
+static void ext4_bdif_drain(struct ext4_blockdev *bdev)
+{
+	while (bdev->bdif->ph_inflight)
+		ext4_bdif_wait(bdev);
+}
+
+static int ext4_bdif_submit(struct ext4_blockdev *bdev, const void *buf,
+			    uint64_t blk_id, uint32_t blk_cnt, bool write)
+{
+	int r;
+
+	while (bdev->bdif->ph_inflight >= CONFIG_BLOCK_DEV_ASYNC_DEPTH)
+		ext4_bdif_wait(bdev);
+
+	ext4_bdif_lock(bdev);
+	if (write) {
+		r = bdev->bdif->submit_write(bdev, buf, blk_id, blk_cnt);
+		bdev->bdif->bwrite_ctr++;
+	} else {
+		r = bdev->bdif->submit_read(bdev, (void *)buf, blk_id, blk_cnt);
+		bdev->bdif->bread_ctr++;
+	}
+	if (r == EOK) {
+		if (write)
+			bdev->bdif->ph_inflight_wr |= 1u << bdev->bdif->ph_inflight;
+		bdev->bdif->ph_inflight++;
+	}
+	ext4_bdif_unlock(bdev);
+
+	if (r == EOK)
+		ext4_bdev_stat_io(bdev, write, blk_cnt, 0);
+	return r;
+}
+
 static int ext4_bdif_bread(struct ext4_blockdev *bdev, void *buf,
 			   uint64_t blk_id, uint32_t blk_cnt)
 {
+	ext4_bdif_drain(bdev);
+	uint32_t t0 = CONFIG_BLOCK_DEV_TIME_US();
 	ext4_bdif_lock(bdev);
 	int r = bdev->bdif->bread(bdev, buf, blk_id, blk_cnt);
 	bdev->bdif->bread_ctr++;
 	ext4_bdif_unlock(bdev);
+	ext4_bdev_stat_io(bdev, false, blk_cnt, t0);
 	return r;
 }
 
 static int ext4_bdif_bwrite(struct ext4_blockdev *bdev, const void *buf,
 			    uint64_t blk_id, uint32_t blk_cnt)
 {
+	ext4_bdif_drain(bdev);
+	uint32_t t0 = CONFIG_BLOCK_DEV_TIME_US();
 	ext4_bdif_lock(bdev);
 	int r = bdev->bdif->bwrite(bdev, buf, blk_id, blk_cnt);
 	bdev->bdif->bwrite_ctr++;
 	ext4_bdif_unlock(bdev);
+	ext4_bdev_stat_io(bdev, true, blk_cnt, t0);
 	return r;
 }
 
+uint32_t ext4_block_time_us(void)
+{
+	return CONFIG_BLOCK_DEV_TIME_US();
+}
+
 int ext4_block_init(struct ext4_blockdev *bdev)
 {
 	int rc = 0;
@@ -94,6 +203,13 @@ int ext4_block_init(struct ext4_blockdev *bdev)
 		   bdev->bdif->close &&
 		   bdev->bdif->bread &&
 		   bdev->bdif->bwrite);
+	ext4_assert(bdev->bdif->wait ||
+		    (!bdev->bdif->submit_read && !bdev->bdif->submit_write));
+
+#if CONFIG_BLOCK_DEV_READAHEAD
+	memset(bdev->ra, 0, sizeof(bdev->ra));
+	bdev->ra_next = 0;
+#endif
 
 	if (bdev->bdif->ph_refctr) {
 		bdev->bdif->ph_refctr++;
@@ -141,6 +257,20 @@ int ext4_block_fini(struct ext4_blockdev *bdev)
 	return bdev->bdif->close(bdev);
 }
 
+/**@brief   Account one write back transfer of cnt cached blocks.*/
+static void ext4_bdev_stat_flush(struct ext4_blockdev *bdev, uint32_t cnt)
+{
+#if CONFIG_BLOCK_DEV_ENABLE_STATS
+	bdev->stats.flushes++;
+	bdev->stats.flush_blocks += cnt;
+	if (bdev->stats.flush_max_blocks < cnt)
+		bdev->stats.flush_max_blocks = cnt;
+#else
+	(void)bdev;
+	(void)cnt;
+#endif
+}
+
 int ext4_block_flush_buf(struct ext4_blockdev *bdev, struct ext4_buf *buf)
 {
 	int r;
@@ -148,7 +278,9 @@ int ext4_block_flush_buf(struct ext4_blockdev *bdev, struct ext4_buf *buf)
 
 	if (ext4_bcache_test_flag(buf, BC_DIRTY) &&
 	    ext4_bcache_test_flag(buf, BC_UPTODATE)) {
+		ext4_bcache_csum_update(buf);
 		r = ext4_blocks_set_direct(bdev, buf->data, buf->lba, 1);
+		ext4_bdev_stat_flush(bdev, 1);
 		if (r) {
 			if (buf->end_write) {
 				bc->dont_shake = true;
@@ -183,6 +315,113 @@ int ext4_block_flush_lba(struct ext4_blockdev *bdev, uint64_t lba)
 	return r;
 }
 
+int ext4_block_flush_lba_range(struct ext4_blockdev *bdev, uint64_t lba,
+			       uint32_t cnt)
+{
+	int r;
+	struct ext4_buf *buf;
+
+	for (; cnt; cnt--, lba++) {
+		buf = ext4_buf_lookup(bdev->bc, lba);
+		if (!buf || !ext4_bcache_test_flag(buf, BC_DIRTY))
+			continue;
+
+		r = ext4_block_flush_buf(bdev, buf);
+		if (r != EOK)
+			return r;
+	}
+	return EOK;
+}
+
+#if CONFIG_BLOCK_DEV_GATHER_SIZE
+static bool ext4_block_gatherable(struct ext4_buf *buf)
+{
+	return buf && buf->on_dirty_list &&
+	       ext4_bcache_test_flag(buf, BC_DIRTY) &&
+	       ext4_bcache_test_flag(buf, BC_UPTODATE);
+}
+
+static uint32_t ext4_block_gather_max(struct ext4_blockdev *bdev)
+{
+	struct ext4_bcache *bc = bdev->bc;
+	uint32_t max = CONFIG_BLOCK_DEV_GATHER_SIZE / bdev->lg_bsize;
+
+	if (max > 1 && !bc->gather_buf)
+		bc->gather_buf = ext4_malloc((size_t)max * bdev->lg_bsize);
+
+	/* No memory for the gather buffer, write block by block.*/
+	return bc->gather_buf ? max : 1;
+}
+
+/**@brief   Write back cnt dirty cached blocks starting at lba with a
+ *          single bwrite call.*/
+static int ext4_block_flush_run(struct ext4_blockdev *bdev, uint64_t lba,
+				uint32_t cnt)
+{
+	int r;
+	uint32_t i;
+	struct ext4_buf *buf;
+	struct ext4_bcache *bc = bdev->bc;
+
+	if (cnt == 1)
+		return ext4_block_flush_buf(bdev, ext4_buf_lookup(bc, lba));
+
+	for (i = 0; i < cnt; i++) {
+		buf = ext4_buf_lookup(bc, lba + i);
+		ext4_bcache_csum_update(buf);
+		memcpy(bc->gather_buf + (size_t)i * bdev->lg_bsize, buf->data,
+		       bdev->lg_bsize);
+	}
+
+	r = ext4_blocks_set_direct(bdev, bc->gather_buf, lba, cnt);
+	ext4_bdev_stat_flush(bdev, cnt);
+
+	/* Complete every buffer like ext4_block_flush_buf does. Buffers
+	 * are looked up again as end_write may modify the cache.*/
+	for (i = 0; i < cnt; i++) {
+		buf = ext4_buf_lookup(bc, lba + i);
+		if (!buf)
+			continue;
+
+		if (r == EOK) {
+			ext4_bcache_remove_dirty_node(bc, buf);
+			ext4_bcache_clear_flag(buf, BC_DIRTY);
+		}
+		if (buf->end_write) {
+			bc->dont_shake = true;
+			buf->end_write(bc, buf, r, buf->end_write_arg);
+			bc->dont_shake = false;
+		}
+	}
+	return r;
+}
+
+/**@brief   Write back a dirty buffer together with the dirty buffers
+ *          cached right before and after it.*/
+static int ext4_block_flush_buf_run(struct ext4_blockdev *bdev,
+				    struct ext4_buf *buf)
+{
+	uint64_t lba = buf->lba;
+	uint32_t cnt = 1;
+	uint32_t max = ext4_block_gather_max(bdev);
+
+	if (!ext4_block_gatherable(buf))
+		return ext4_block_flush_buf(bdev, buf);
+
+	while (cnt < max && lba &&
+	       ext4_block_gatherable(ext4_buf_lookup(bdev->bc, lba - 1))) {
+		lba--;
+		cnt++;
+	}
+
+	while (cnt < max &&
+	       ext4_block_gatherable(ext4_buf_lookup(bdev->bc, lba + cnt)))
+		cnt++;
+
+	return ext4_block_flush_run(bdev, lba, cnt);
+}
+#endif
+
 int ext4_block_cache_shake(struct ext4_blockdev *bdev)
 {
 	int r = EOK;
@@ -192,13 +431,20 @@ int ext4_block_cache_shake(struct ext4_blockdev *bdev)
 
 	bdev->bc->dont_shake = true;
 
-	while (!RB_EMPTY(&bdev->bc->lru_root) &&
-		ext4_bcache_is_full(bdev->bc)) {
+	while (ext4_bcache_is_full(bdev->bc)) {
 
 		buf = ext4_buf_lowest_lru(bdev->bc);
-		ext4_assert(buf);
+		if (!buf)
+			break;
+
+		ext4_bdev_stat_add(bdev, evictions, 1);
 		if (ext4_bcache_test_flag(buf, BC_DIRTY)) {
+			ext4_bdev_stat_add(bdev, dirty_evictions, 1);
+#if CONFIG_BLOCK_DEV_GATHER_SIZE
+			r = ext4_block_flush_buf_run(bdev, buf);
+#else
 			r = ext4_block_flush_buf(bdev, buf);
+#endif
 			if (r != EOK)
 				break;
 
@@ -240,20 +486,166 @@ int ext4_block_get_noread(struct ext4_blockdev *bdev, struct ext4_block *b,
 	return EOK;
 }
 
-int ext4_block_get(struct ext4_blockdev *bdev, struct ext4_block *b,
-		   uint64_t lba)
+#if EXT4_BLOCK_READAHEAD
+/**@brief   Most blocks one miss may read: blocks read ahead are staged in
+ *          the gather buffer and take at most half the cache.*/
+static uint32_t ext4_block_ra_max(struct ext4_blockdev *bdev)
+{
+	uint32_t max = CONFIG_BLOCK_DEV_READAHEAD;
+
+	if (max > bdev->bc->cnt / 2)
+		max = bdev->bc->cnt / 2;
+	if (max > 1 && max > ext4_block_gather_max(bdev))
+		max = ext4_block_gather_max(bdev);
+
+	return max ? max : 1;
+}
+
+/**@brief   Stream of ra (n entries) the reader of lba goes on with.
+ * @return  stream (NULL if lba does not follow any of them)*/
+static struct ext4_block_ra *ext4_block_ra_find(struct ext4_block_ra *ra,
+						uint32_t n, uint64_t lba)
+{
+	uint32_t i;
+
+	for (i = 0; i < n; i++)
+		if (ra[i].win && ra[i].next == lba)
+			return &ra[i];
+
+	return NULL;
+}
+
+/**@brief   Read b (cache miss) together with the uncached blocks right
+ *          after it, at most cnt blocks, by one device read. The blocks
+ *          after b get buffers only while the cache has clean ones to
+ *          spare, readahead never writes back.
+ * @return  standard error code, blocks read in *rcnt*/
+static int ext4_block_read_ahead(struct ext4_blockdev *bdev,
+				 struct ext4_block *b, uint32_t cnt,
+				 uint32_t *rcnt)
+{
+	int r;
+	uint32_t i;
+	uint32_t n = 1;
+	uint64_t lba = b->lb_id;
+	struct ext4_block tmp;
+	struct ext4_buf *buf;
+	struct ext4_bcache *bc = bdev->bc;
+
+	if (cnt > bdev->lg_bcnt - lba)
+		cnt = (uint32_t)(bdev->lg_bcnt - lba);
+
+	/* The buffers stay referenced until filled, so taking the next one
+	 * cannot evict them */
+	while (n < cnt && !bc->dont_shake && !ext4_buf_lookup(bc, lba + n)) {
+		if (ext4_bcache_is_full(bc)) {
+			buf = ext4_buf_lowest_lru(bc);
+			if (!buf || ext4_bcache_test_flag(buf, BC_DIRTY))
+				break;
+		}
+
+		if (ext4_block_get_noread(bdev, &tmp, lba + n) != EOK)
+			break;
+		n++;
+	}
+
+	if (n == 1) {
+		*rcnt = 1;
+		return ext4_blocks_get_direct(bdev, b->data, lba, 1);
+	}
+
+	r = ext4_blocks_get_direct(bdev, bc->gather_buf, lba, n);
+	if (r == EOK) {
+		memcpy(b->data, bc->gather_buf, bdev->lg_bsize);
+		ext4_bdev_stat_add(bdev, readaheads, 1);
+		ext4_bdev_stat_add(bdev, readahead_blocks, n - 1);
+	}
+
+	/* Release the blocks read ahead, the failed ones are dropped */
+	for (i = 1; i < n; i++) {
+		buf = ext4_buf_lookup(bc, lba + i);
+		if (r == EOK) {
+			memcpy(buf->data,
+			       bc->gather_buf + (size_t)i * bdev->lg_bsize,
+			       bdev->lg_bsize);
+			ext4_bcache_set_flag(buf, BC_UPTODATE);
+		}
+
+		tmp.lb_id = lba + i;
+		tmp.buf = buf;
+		tmp.data = buf->data;
+		ext4_bcache_free(bc, &tmp);
+	}
+
+	*rcnt = n;
+	return r;
+}
+#endif
+
+/**@brief   Get a block through the cache, reading ahead on a miss that
+ *          goes on with one of the n readers in ra (see ext4_block_get).
+ *          Any other miss starts a new reader in ra[*slot] and
+ *          moves *slot on.*/
+static int ext4_block_get_streams(struct ext4_blockdev *bdev,
+				  struct ext4_block *b, uint64_t lba,
+				  struct ext4_block_ra *ra, uint32_t n,
+				  uint32_t *slot, uint32_t max)
 {
 	int r = ext4_block_get_noread(bdev, b, lba);
 	if (r != EOK)
 		return r;
 
+#if EXT4_BLOCK_READAHEAD
+	struct ext4_block_ra *s = ra ? ext4_block_ra_find(ra, n, lba) : NULL;
+	uint32_t win = 1;
+	uint32_t cnt;
+#else
+	(void)ra;
+	(void)n;
+	(void)slot;
+	(void)max;
+#endif
+
 	if (ext4_bcache_test_flag(b->buf, BC_UPTODATE)) {
 		/* Data in the cache is up-to-date.
 		 * Reading from physical device is not required */
+		ext4_bdev_stat_add(bdev, cache_hits, 1);
+#if EXT4_BLOCK_READAHEAD
+		if (s)
+			s->next = lba + 1;
+#endif
 		return EOK;
 	}
 
+	ext4_bdev_stat_add(bdev, cache_misses, 1);
+
+#if EXT4_BLOCK_READAHEAD
+	if (s) {
+		uint32_t ra_max = ext4_block_ra_max(bdev);
+
+		win = s->win * 2;
+		if (win > ra_max)
+			win = ra_max;
+	} else if (ra) {
+		s = &ra[*slot];
+		*slot = (*slot + 1) % n;
+	}
+
+	cnt = win < max ? win : max;
+	if (cnt > 1) {
+		r = ext4_block_read_ahead(bdev, b, cnt, &cnt);
+	} else {
+		cnt = 1;
+		r = ext4_blocks_get_direct(bdev, b->data, lba, 1);
+	}
+
+	if (s) {
+		s->win = win;
+		s->next = lba + cnt;
+	}
+#else
 	r = ext4_blocks_get_direct(bdev, b->data, lba, 1);
+#endif
 	if (r != EOK) {
 		ext4_bcache_free(bdev->bc, b);
 		b->lb_id = 0;
@@ -266,6 +658,26 @@ int ext4_block_get(struct ext4_blockdev *bdev, struct ext4_block *b,
 	return EOK;
 }
 
+int ext4_block_get(struct ext4_blockdev *bdev, struct ext4_block *b,
+		   uint64_t lba)
+{
+#if EXT4_BLOCK_READAHEAD
+	return ext4_block_get_streams(bdev, b, lba, bdev->ra,
+				      CONFIG_BLOCK_DEV_READAHEAD_STREAMS,
+				      &bdev->ra_next, UINT32_MAX);
+#else
+	return ext4_block_get_streams(bdev, b, lba, NULL, 0, NULL, 1);
+#endif
+}
+
+int ext4_block_get_ra(struct ext4_blockdev *bdev, struct ext4_block *b,
+		      uint64_t lba, struct ext4_block_ra *ra, uint32_t max)
+{
+	uint32_t slot = 0;
+
+	return ext4_block_get_streams(bdev, b, lba, ra, 1, &slot, max);
+}
+
 int ext4_block_set(struct ext4_blockdev *bdev, struct ext4_block *b)
 {
 	ext4_assert(bdev && b);
@@ -304,6 +716,48 @@ int ext4_blocks_set_direct(struct ext4_blockdev *bdev, const void *buf,
 	return ext4_bdif_bwrite(bdev, buf, pba, pb_cnt * cnt);
 }
 
+int ext4_blocks_get_direct_async(struct ext4_blockdev *bdev, void *buf,
+				 uint64_t lba, uint32_t cnt)
+{
+	uint64_t pba;
+	uint32_t pb_cnt;
+	ext4_assert(bdev && buf);
+
+	if (!bdev->bdif->submit_read)
+		return ext4_blocks_get_direct(bdev, buf, lba, cnt);
+
+	pba = (lba * bdev->lg_bsize + bdev->part_offset) / bdev->bdif->ph_bsize;
+	pb_cnt = bdev->lg_bsize / bdev->bdif->ph_bsize;
+
+	return ext4_bdif_submit(bdev, buf, pba, pb_cnt * cnt, false);
+}
+
+int ext4_blocks_set_direct_async(struct ext4_blockdev *bdev, const void *buf,
+				 uint64_t lba, uint32_t cnt)
+{
+	uint64_t pba;
+	uint32_t pb_cnt;
+	ext4_assert(bdev && buf);
+
+	if (!bdev->bdif->submit_write)
+		return ext4_blocks_set_direct(bdev, buf, lba, cnt);
+
+	pba = (lba * bdev->lg_bsize + bdev->part_offset) / bdev->bdif->ph_bsize;
+	pb_cnt = bdev->lg_bsize / bdev->bdif->ph_bsize;
+
+	return ext4_bdif_submit(bdev, buf, pba, pb_cnt * cnt, true);
+}
+
+int ext4_blocks_wait(struct ext4_blockdev *bdev)
+{
+	int r;
+
+	ext4_bdif_drain(bdev);
+	r = bdev->bdif->ph_async_err;
+	bdev->bdif->ph_async_err = EOK;
+	return r;
+}
+
 int ext4_block_writebytes(struct ext4_blockdev *bdev, uint64_t off,
 			  const void *buf, uint32_t len)
 {
@@ -438,10 +892,56 @@ int ext4_block_readbytes(struct ext4_blockdev *bdev, uint64_t off, void *buf,
 	return r;
 }
 
+/**@brief   Move block group descriptor changes of the mounted filesystem
+ *          from its in-memory table into the cache (ext4_fs_bgd_sync).
+ *          Deferred checksums go first, bitmap checksums live in the
+ *          descriptors.*/
+static int ext4_block_cache_sync_fs(struct ext4_blockdev *bdev)
+{
+	ext4_bcache_csum_update_dirty(bdev->bc);
+
+	if (!bdev->fs || !bdev->fs->bgd_dirty)
+		return EOK;
+
+	return ext4_fs_bgd_sync(bdev->fs);
+}
+
 int ext4_block_cache_flush(struct ext4_blockdev *bdev)
 {
+	int r;
+#if CONFIG_BLOCK_DEV_GATHER_SIZE
+	struct ext4_bcache *bc = bdev->bc;
+	uint32_t max = ext4_block_gather_max(bdev);
+#endif
+
+	r = ext4_block_cache_sync_fs(bdev);
+	if (r != EOK)
+		return r;
+
+#if CONFIG_BLOCK_DEV_GATHER_SIZE
+	/* Write back in LBA order, consecutive blocks in one bwrite.*/
+	ext4_bcache_sort_dirty(bc);
+	while (!SLIST_EMPTY(&bc->dirty_list)) {
+		uint32_t cnt = 1;
+		struct ext4_buf *buf = SLIST_FIRST(&bc->dirty_list);
+		struct ext4_buf *next = SLIST_NEXT(buf, dirty_node);
+
+		if (ext4_block_gatherable(buf)) {
+			while (cnt < max && next &&
+			       next->lba == buf->lba + cnt &&
+			       ext4_block_gatherable(next)) {
+				next = SLIST_NEXT(next, dirty_node);
+				cnt++;
+			}
+		}
+
+		r = ext4_block_flush_run(bdev, buf->lba, cnt);
+		if (r != EOK)
+			return r;
+	}
+	return EOK;
+#else
 	while (!SLIST_EMPTY(&bdev->bc->dirty_list)) {
-		int r;
 		struct ext4_buf *buf = SLIST_FIRST(&bdev->bc->dirty_list);
 		ext4_assert(buf);
 		r = ext4_block_flush_buf(bdev, buf);
@@ -450,6 +950,71 @@ int ext4_block_cache_flush(struct ext4_blockdev *bdev)
 
 	}
 	return EOK;
+#endif
+}
+
+static bool ext4_block_owned(struct ext4_buf *buf, uint32_t owner)
+{
+	return buf->owner == owner || buf->owner == EXT4_BCACHE_OWNER_SHARED;
+}
+
+int ext4_block_cache_flush_owner(struct ext4_blockdev *bdev, uint32_t owner)
+{
+	int r;
+	struct ext4_bcache *bc = bdev->bc;
+	struct ext4_buf *buf, *next;
+#if CONFIG_BLOCK_DEV_GATHER_SIZE
+	uint32_t cnt;
+	uint32_t max = ext4_block_gather_max(bdev);
+#endif
+
+	r = ext4_block_cache_sync_fs(bdev);
+	if (r != EOK)
+		return r;
+
+#if CONFIG_BLOCK_DEV_GATHER_SIZE
+
+	/* Same as ext4_block_cache_flush, skipping the buffers of others.
+	 * A run ends at the first buffer that is not written, so next is
+	 * still on the dirty list after the run is gone.*/
+	ext4_bcache_sort_dirty(bc);
+	buf = SLIST_FIRST(&bc->dirty_list);
+	while (buf) {
+		next = SLIST_NEXT(buf, dirty_node);
+		if (!ext4_block_owned(buf, owner)) {
+			buf = next;
+			continue;
+		}
+
+		cnt = 1;
+		if (ext4_block_gatherable(buf)) {
+			while (cnt < max && next &&
+			       next->lba == buf->lba + cnt &&
+			       ext4_block_owned(next, owner) &&
+			       ext4_block_gatherable(next)) {
+				next = SLIST_NEXT(next, dirty_node);
+				cnt++;
+			}
+		}
+
+		r = ext4_block_flush_run(bdev, buf->lba, cnt);
+		if (r != EOK)
+			return r;
+		buf = next;
+	}
+#else
+	buf = SLIST_FIRST(&bc->dirty_list);
+	while (buf) {
+		next = SLIST_NEXT(buf, dirty_node);
+		if (ext4_block_owned(buf, owner)) {
+			r = ext4_block_flush_buf(bdev, buf);
+			if (r != EOK)
+				return r;
+		}
+		buf = next;
+	}
+#endif
+	return EOK;
 }
 
 int ext4_block_cache_write_back(struct ext4_blockdev *bdev, uint8_t on_off)
@@ -80,6 +80,31 @@ struct ext4_blockdev_iface {
 	 * @param   bdev block device.*/
 	int (*unlock)(struct ext4_blockdev *bdev);
 
+	/**@brief   Start a block read and return without waiting for it.
+	 *          Not mandatory field, bread is used if not set. Transfers
+	 *          must complete in submission order.
+	 * @param   bdev block device
+	 * @param   buf output buffer (valid until the transfer is waited for)
+	 * @param   blk_id block id
+	 * @param   blk_cnt block count*/
+	int (*submit_read)(struct ext4_blockdev *bdev, void *buf,
+			   uint64_t blk_id, uint32_t blk_cnt);
+
+	/**@brief   Start a block write and return without waiting for it.
+	 *          Not mandatory field, bwrite is used if not set.
+	 * @param   bdev block device
+	 * @param   buf input buffer (valid until the transfer is waited for)
+	 * @param   blk_id block id
+	 * @param   blk_cnt block count*/
+	int (*submit_write)(struct ext4_blockdev *bdev, const void *buf,
+			    uint64_t blk_id, uint32_t blk_cnt);
+
+	/**@brief   Wait for the oldest submitted transfer. Mandatory if
+	 *          submit_read/submit_write are set.
+	 * @param   bdev block device
+	 * @return  result of that transfer*/
+	int (*wait)(struct ext4_blockdev *bdev);
+
 	/**@brief   Block size (bytes): physical*/
 	uint32_t ph_bsize;
 
@@ -98,10 +123,72 @@ struct ext4_blockdev_iface {
 	/**@brief   Physical write counter*/
 	uint32_t bwrite_ctr;
 
+	/**@brief   Submitted transfers not waited for yet*/
+	uint32_t ph_inflight;
+
+	/**@brief   First error of a submitted transfer (see ext4_blocks_wait)*/
+	int ph_async_err;
+
+	/**@brief   Direction of submitted transfers, bit 0 is the oldest
+	 *          (1 - write)*/
+	uint32_t ph_inflight_wr;
+
 	/**@brief   User data pointer*/
 	void* p_user;
 };
 
+/**@brief   Block cache and device I/O statistics of a block device
+ *          (CONFIG_BLOCK_DEV_ENABLE_STATS).*/
+struct ext4_io_stats {
+	/**@brief   Block reads served from the cache*/
+	uint32_t cache_hits;
+
+	/**@brief   Block reads that went to the device*/
+	uint32_t cache_misses;
+
+	/**@brief   Misses that also read the blocks after the missed one,
+	 *          and the blocks read that way (CONFIG_BLOCK_DEV_READAHEAD)*/
+	uint32_t readaheads;
+	uint32_t readahead_blocks;
+
+	/**@brief   Buffers dropped to make room in the cache*/
+	uint32_t evictions;
+
+	/**@brief   Evicted buffers that had to be written first*/
+	uint32_t dirty_evictions;
+
+	/**@brief   Write back transfers of cached buffers*/
+	uint32_t flushes;
+
+	/**@brief   Blocks written by those transfers*/
+	uint32_t flush_blocks;
+
+	/**@brief   Most blocks written back by one transfer*/
+	uint32_t flush_max_blocks;
+
+	/**@brief   Device read/write transfers*/
+	uint32_t reads;
+	uint32_t writes;
+
+	/**@brief   Bytes read/written*/
+	uint64_t read_bytes;
+	uint64_t write_bytes;
+
+	/**@brief   Time spent in device reads/writes (CONFIG_BLOCK_DEV_TIME_US)*/
+	uint64_t read_time_us;
+	uint64_t write_time_us;
+};
+
+/**@brief   Sequential reader, for readahead (see @ref ext4_block_get_ra).*/
+struct ext4_block_ra {
+	/**@brief   Block after the last one read, where the reader goes on*/
+	uint64_t next;
+
+	/**@brief   Blocks read at the last miss, doubled at the next
+	 *          sequential one (0 - unused)*/
+	uint32_t win;
+};
+
 /**@brief   Definition of the simple block device.*/
 struct ext4_blockdev {
 	/**@brief Block device interface*/
@@ -128,6 +215,16 @@ struct ext4_blockdev {
 	/**@brief   The filesystem this block device belongs to. */
 	struct ext4_fs *fs;
 
+	/**@brief   I/O statistics since mount (or last reset).*/
+	struct ext4_io_stats stats;
+
+#if CONFIG_BLOCK_DEV_READAHEAD
+	/**@brief   Sequential readers of metadata blocks (ext4_block_get)
+	 *          and the next one to replace.*/
+	struct ext4_block_ra ra[CONFIG_BLOCK_DEV_READAHEAD_STREAMS];
+	uint32_t ra_next;
+#endif
+
 	void *journal;
 };
 
@@ -152,6 +249,12 @@ struct ext4_blockdev {
 		.part_size =  (__bcnt) * (__bsize),                            \
 	}
 
+/**@brief   Microsecond time stamp (CONFIG_BLOCK_DEV_TIME_US), for
+ *          modules that do not see the clock header. It wraps, compare
+ *          time stamps by their uint32_t difference.
+ * @return  time stamp (0 - no clock)*/
+uint32_t ext4_block_time_us(void);
+
 /**@brief   Block device initialization.
  * @param   bdev block device descriptor
  * @param   bg_bsize logical block size
@@ -183,6 +286,15 @@ int ext4_block_flush_buf(struct ext4_blockdev *bdev, struct ext4_buf *buf);
  * @return  standard error code*/
 int ext4_block_flush_lba(struct ext4_blockdev *bdev, uint64_t lba);
 
+/**@brief   Flush dirty buffers of a range of lbas to disk, so that
+ *          a direct read of the range sees their data.
+ * @param   bdev block device descriptor
+ * @param   lba first logical block address
+ * @param   cnt block count
+ * @return  standard error code*/
+int ext4_block_flush_lba_range(struct ext4_blockdev *bdev, uint64_t lba,
+			       uint32_t cnt);
+
 /**@brief   Set logical block size in block device.
  * @param   bdev block device descriptor
  * @param   lb_size logical block size (in bytes)
@@ -197,7 +309,10 @@ void ext4_block_set_lb_size(struct ext4_blockdev *bdev, uint32_t lb_bsize);
 int ext4_block_get_noread(struct ext4_blockdev *bdev, struct ext4_block *b,
 			  uint64_t lba);
 
-/**@brief   Block get function (through cache).
+/**@brief   Block get function (through cache). A miss that goes on
+ *          where the reader stopped also reads the uncached blocks that
+ *          follow lba, up to the readahead window, by the same device
+ *          read. Directory and inode table scans are followed this way.
  * @param   bdev block device descriptor
  * @param   b block descriptor
  * @param   lba logical block address
@@ -205,6 +320,18 @@ int ext4_block_get_noread(struct ext4_blockdev *bdev, struct ext4_block *b,
 int ext4_block_get(struct ext4_blockdev *bdev, struct ext4_block *b,
 		   uint64_t lba);
 
+/**@brief   Block get function (through cache) for a reader that keeps
+ *          its own readahead state, like an open file.
+ * @param   bdev block device descriptor
+ * @param   b block descriptor
+ * @param   lba logical block address
+ * @param   ra readahead state of the reader (NULL - no readahead)
+ * @param   max blocks from lba on that belong to the reader (eg: the
+ *          rest of an extent), at most that many are read
+ * @return  standard error code*/
+int ext4_block_get_ra(struct ext4_blockdev *bdev, struct ext4_block *b,
+		      uint64_t lba, struct ext4_block_ra *ra, uint32_t max);
+
 /**@brief   Block set procedure (through cache).
  * @param   bdev block device descriptor
  * @param   b block descriptor
@@ -227,6 +354,34 @@ int ext4_blocks_get_direct(struct ext4_blockdev *bdev, void *buf, uint64_t lba,
 int ext4_blocks_set_direct(struct ext4_blockdev *bdev, const void *buf,
 			   uint64_t lba, uint32_t cnt);
 
+/**@brief   Start a block read (without cache). Up to
+ *          CONFIG_BLOCK_DEV_ASYNC_DEPTH transfers are kept in flight if
+ *          the interface has submit hooks, otherwise same as
+ *          ext4_blocks_get_direct. buf must stay valid until
+ *          ext4_blocks_wait returns.
+ * @param   bdev block device descriptor
+ * @param   buf output buffer
+ * @param   lba logical block address
+ * @param   cnt block count
+ * @return  standard error code*/
+int ext4_blocks_get_direct_async(struct ext4_blockdev *bdev, void *buf,
+				 uint64_t lba, uint32_t cnt);
+
+/**@brief   Start a block write (without cache). See
+ *          ext4_blocks_get_direct_async.
+ * @param   bdev block device descriptor
+ * @param   buf input buffer
+ * @param   lba logical block address
+ * @param   cnt block count
+ * @return  standard error code*/
+int ext4_blocks_set_direct_async(struct ext4_blockdev *bdev, const void *buf,
+				 uint64_t lba, uint32_t cnt);
+
+/**@brief   Wait for all started transfers.
+ * @param   bdev block device descriptor
+ * @return  first error of the transfers completed since the last call*/
+int ext4_blocks_wait(struct ext4_blockdev *bdev);
+
 /**@brief   Write to block device (by direct address).
  * @param   bdev block device descriptor
  * @param   off byte offset in block device
@@ -250,6 +405,14 @@ int ext4_block_readbytes(struct ext4_blockdev *bdev, uint64_t off, void *buf,
  * @return  standard error code*/
 int ext4_block_cache_flush(struct ext4_blockdev *bdev);
 
+/**@brief   Flush the dirty buffers of one inode to disk: the buffers
+ *          tagged with owner (see ext4_bcache::owner) and the buffers
+ *          shared with other inodes. Buffers of other inodes stay.
+ * @param   bdev block device descriptor
+ * @param   owner inode number
+ * @return  standard error code*/
+int ext4_block_cache_flush_owner(struct ext4_blockdev *bdev, uint32_t owner);
+
 /**@brief   Enable/disable write back cache mode
  * @param   bdev block device descriptor
  * @param   on_off
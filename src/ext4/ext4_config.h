@@ -124,11 +124,117 @@ extern "C" {
 #define CONFIG_BLOCK_DEV_ENABLE_STATS 1
 #endif
 
+/**@brief   Microsecond time stamp for the device time statistics and
+ *          the ext4_fstream interval (0 - no clock, neither is done).
+ *          32 bit like micros(), it wraps (every 71.6 min) and is only
+ *          used for uint32_t differences.*/
+#ifndef CONFIG_BLOCK_DEV_TIME_US
+#ifdef ARDUINO
+#define CONFIG_BLOCK_DEV_TIME_US() ((uint32_t)micros())
+#else
+#define CONFIG_BLOCK_DEV_TIME_US() ((uint32_t)0)
+#endif
+#endif
+
 /**@brief   Cache size of block device.*/
 #ifndef CONFIG_BLOCK_DEV_CACHE_SIZE
 #define CONFIG_BLOCK_DEV_CACHE_SIZE 16
 #endif
 
+/**@brief   Preallocate the block cache buffers at mount time (one arena of
+ *          CONFIG_BLOCK_DEV_CACHE_SIZE * block size) and recycle them
+ *          through a free list instead of malloc/free on every cache miss.*/
+#ifndef CONFIG_BLOCK_DEV_CACHE_POOL
+#define CONFIG_BLOCK_DEV_CACHE_POOL 1
+#endif
+
+/**@brief   Block cache index. 0 - red-black trees ordered by LBA and LRU id,
+ *          1 - open addressed LBA hash table plus a doubly linked LRU list
+ *          (O(1) lookup, touch and evict).*/
+#ifndef CONFIG_BLOCK_DEV_CACHE_HASH
+#define CONFIG_BLOCK_DEV_CACHE_HASH 1
+#endif
+
+/**@brief   Gather buffer size in bytes. Dirty blocks with consecutive LBAs
+ *          are copied into it and written back with a single bwrite call
+ *          (0 - one bwrite call per block).*/
+#ifndef CONFIG_BLOCK_DEV_GATHER_SIZE
+#define CONFIG_BLOCK_DEV_GATHER_SIZE (64 * 1024)
+#endif
+
+/**@brief   Most blocks read ahead by one device read when blocks are
+ *          read in order: the data of each open file, and directory and
+ *          inode table blocks. The window doubles on every sequential
+ *          miss, up to this, the gather buffer (needed) and half the
+ *          block cache (0 - one block per read).*/
+#ifndef CONFIG_BLOCK_DEV_READAHEAD
+#define CONFIG_BLOCK_DEV_READAHEAD 16
+#endif
+
+/**@brief   Sequential metadata readers followed per block device.*/
+#ifndef CONFIG_BLOCK_DEV_READAHEAD_STREAMS
+#define CONFIG_BLOCK_DEV_READAHEAD_STREAMS 4
+#endif
+
+/**@brief   Maximum transfers in flight for block devices with
+ *          submit_read/submit_write hooks (2 - double buffering).*/
+#ifndef CONFIG_BLOCK_DEV_ASYNC_DEPTH
+#define CONFIG_BLOCK_DEV_ASYNC_DEPTH 2
+#endif
+
+
+/**@brief   Extent runs remembered by each open file, so sequential small
+ *          reads and writes map blocks without an extent tree lookup
+ *          (0 - disabled).*/
+#ifndef CONFIG_EXT4_FILE_MAP_CACHE
+#define CONFIG_EXT4_FILE_MAP_CACHE 4
+#endif
+
+/**@brief   Directory entry cache entries per mount point. Path walks look
+ *          names up here before searching the directory blocks
+ *          (0 - disabled).*/
+#ifndef CONFIG_EXT4_DCACHE_SIZE
+#define CONFIG_EXT4_DCACHE_SIZE 32
+#endif
+
+/**@brief   Longest name kept in the directory entry cache*/
+#ifndef CONFIG_EXT4_DCACHE_NAME_LEN
+#define CONFIG_EXT4_DCACHE_NAME_LEN 24
+#endif
+
+/**@brief   Largest in-memory block group descriptor table in bytes
+ *          (descriptor size + 5 bytes per group). Filesystems with more
+ *          groups use the descriptor blocks in the block cache
+ *          (0 - disabled).*/
+#ifndef CONFIG_EXT4_BGD_TABLE_MAX
+#define CONFIG_EXT4_BGD_TABLE_MAX (32 * 1024)
+#endif
+
+/**@brief   Compute bitmap, inode and directory block checksums once, when
+ *          the block is written back, instead of on every change. Used
+ *          with write back caching and no journal running.*/
+#ifndef CONFIG_EXT4_CSUM_DEFER
+#define CONFIG_EXT4_CSUM_DEFER 1
+#endif
+
+/**@brief   CRC32C table code: 1 - byte at a time (1 KB table),
+ *          8 - slice by 8, eight bytes per step (8 KB of tables).*/
+#ifndef CONFIG_EXT4_CRC32C_SLICE
+#define CONFIG_EXT4_CRC32C_SLICE 8
+#endif
+
+/**@brief   CRC32C hardware engine, used instead of the tables:
+ *          0 - none,
+ *          1 - x86 SSE4.2 crc32 instruction (host builds with -msse4.2),
+ *          2 - STM32H7 CRC unit (GIGA), not to be used by others,
+ *          3 - ext4_crc32c_hw() provided by the port.*/
+#ifndef CONFIG_EXT4_CRC32C_HW
+#if defined(__SSE4_2__)
+#define CONFIG_EXT4_CRC32C_HW 1
+#else
+#define CONFIG_EXT4_CRC32C_HW 0
+#endif
+#endif
 
 /**@brief   Maximum block device name*/
 #ifndef CONFIG_EXT4_MAX_BLOCKDEV_NAME
@@ -61,6 +61,26 @@ uint32_t ext4_crc32(uint32_t crc, const void *buf, uint32_t size);
  * @return	updated crc32c value*/
 uint32_t ext4_crc32c(uint32_t crc, const void *buf, uint32_t size);
 
+/**@brief	CRC32C over size zero bytes, in O(log size) steps. As the
+ *		algorithm is linear, the checksum of a buffer after some of
+ *		its bytes are XORed with d is the old one XOR
+ *		ext4_crc32c_zeros(ext4_crc32c(0, d, len), bytes after d).
+ * @param	crc input feed
+ * @param	size number of zero bytes
+ * @return	updated crc32c value*/
+uint32_t ext4_crc32c_zeros(uint32_t crc, uint32_t size);
+
+#if CONFIG_EXT4_CRC32C_HW == 3
+/**@brief	CRC32C engine of the port (CONFIG_EXT4_CRC32C_HW 3), same
+ *		contract as ext4_crc32c: reflected 0x1EDC6F41 polynomial, no
+ *		final inversion.
+ * @param	crc input feed
+ * @param 	buf input buffer
+ * @param	length input buffer length (bytes)
+ * @return	updated crc32c value*/
+uint32_t ext4_crc32c_hw(uint32_t crc, const void *buf, uint32_t size);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,192 @@
+/* ext4_dcache.c - Directory entry cache for lwext4.
+ * Copyright (c) 2022-2024, Warren Watson.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice, development funding notice, and this permission
+ * notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/** @addtogroup lwext4
+ * @{
+ */
+/**
+ * @file  ext4_dcache.c
+ * @brief Directory entry cache.
+ */
+
+#include "ext4_config.h"
+#include "ext4_dcache.h"
+
+#include <string.h>
+
+void ext4_dcache_init(struct ext4_dcache *dc)
+{
+	memset(dc, 0, sizeof(struct ext4_dcache));
+}
+
+#if CONFIG_EXT4_DCACHE_SIZE
+
+/**@brief   FNV-1a of the name, seeded with the parent inode.*/
+static uint32_t ext4_dcache_hash(uint32_t parent, const char *name,
+				 uint32_t len)
+{
+	uint32_t h = 2166136261u ^ parent;
+
+	while (len--) {
+		h ^= (uint8_t)*name++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static struct ext4_dcache_entry *
+ext4_dcache_find(struct ext4_dcache *dc, uint32_t parent, uint32_t hash,
+		 const char *name, uint32_t len)
+{
+	for (uint32_t i = 0; i < CONFIG_EXT4_DCACHE_SIZE; i++) {
+		struct ext4_dcache_entry *e = &dc->entry[i];
+		if (e->parent != parent || e->hash != hash)
+			continue;
+		if (e->name_len == len && !memcmp(e->name, name, len))
+			return e;
+	}
+	return NULL;
+}
+
+bool ext4_dcache_lookup(struct ext4_dcache *dc, uint32_t parent,
+			const char *name, uint32_t len, uint32_t *inode,
+			uint32_t *imode)
+{
+	struct ext4_dcache_entry *e = NULL;
+
+	if (len <= CONFIG_EXT4_DCACHE_NAME_LEN)
+		e = ext4_dcache_find(dc, parent,
+				     ext4_dcache_hash(parent, name, len),
+				     name, len);
+	if (!e)
+		return false;
+
+	e->lru = ++dc->lru_ctr;
+	*inode = e->inode;
+	*imode = e->imode;
+	return true;
+}
+
+void ext4_dcache_insert(struct ext4_dcache *dc, uint32_t parent,
+			const char *name, uint32_t len, uint32_t inode,
+			uint32_t imode)
+{
+	struct ext4_dcache_entry *e;
+	uint32_t hash;
+
+	if (!len || len > CONFIG_EXT4_DCACHE_NAME_LEN)
+		return;
+	if (name[0] == '.' && (len == 1 || (len == 2 && name[1] == '.')))
+		return;
+
+	hash = ext4_dcache_hash(parent, name, len);
+	e = ext4_dcache_find(dc, parent, hash, name, len);
+	if (!e) {
+		/*Free slot or the least recently used one*/
+		e = &dc->entry[0];
+		for (uint32_t i = 0; i < CONFIG_EXT4_DCACHE_SIZE; i++) {
+			if (!dc->entry[i].parent) {
+				e = &dc->entry[i];
+				break;
+			}
+			if (dc->entry[i].lru < e->lru)
+				e = &dc->entry[i];
+		}
+	}
+
+	e->parent = parent;
+	e->hash = hash;
+	e->inode = inode;
+	e->imode = imode;
+	e->lru = ++dc->lru_ctr;
+	e->name_len = (uint8_t)len;
+	memcpy(e->name, name, len);
+}
+
+void ext4_dcache_remove(struct ext4_dcache *dc, uint32_t parent,
+			const char *name, uint32_t len)
+{
+	struct ext4_dcache_entry *e;
+
+	if (len > CONFIG_EXT4_DCACHE_NAME_LEN)
+		return;
+
+	e = ext4_dcache_find(dc, parent, ext4_dcache_hash(parent, name, len),
+			     name, len);
+	if (e)
+		e->parent = 0;
+}
+
+void ext4_dcache_purge_dir(struct ext4_dcache *dc, uint32_t parent)
+{
+	for (uint32_t i = 0; i < CONFIG_EXT4_DCACHE_SIZE; i++)
+		if (dc->entry[i].parent == parent)
+			dc->entry[i].parent = 0;
+}
+
+#else
+
+bool ext4_dcache_lookup(struct ext4_dcache *dc, uint32_t parent,
+			const char *name, uint32_t len, uint32_t *inode,
+			uint32_t *imode)
+{
+	(void)dc;
+	(void)parent;
+	(void)name;
+	(void)len;
+	(void)inode;
+	(void)imode;
+	return false;
+}
+
+void ext4_dcache_insert(struct ext4_dcache *dc, uint32_t parent,
+			const char *name, uint32_t len, uint32_t inode,
+			uint32_t imode)
+{
+	(void)dc;
+	(void)parent;
+	(void)name;
+	(void)len;
+	(void)inode;
+	(void)imode;
+}
+
+void ext4_dcache_remove(struct ext4_dcache *dc, uint32_t parent,
+			const char *name, uint32_t len)
+{
+	(void)dc;
+	(void)parent;
+	(void)name;
+	(void)len;
+}
+
+void ext4_dcache_purge_dir(struct ext4_dcache *dc, uint32_t parent)
+{
+	(void)dc;
+	(void)parent;
+}
+
+#endif
+
+/**
+ * @}
+ */
@@ -0,0 +1,131 @@
+/* ext4_dcache.h - Directory entry cache for lwext4.
+ * Copyright (c) 2022-2024, Warren Watson.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice, development funding notice, and this permission
+ * notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/** @addtogroup lwext4
+ * @{
+ */
+/**
+ * @file  ext4_dcache.h
+ * @brief Directory entry cache. Remembers (parent inode, name) -> inode
+ *        results of directory lookups, including names that do not exist,
+ *        so path walks skip ext4_dir_find_entry for hot components.
+ */
+
+#ifndef EXT4_DCACHE_H_
+#define EXT4_DCACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "ext4_config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**@brief   Single cached directory entry.*/
+struct ext4_dcache_entry {
+	/**@brief   Parent directory inode (0 - free slot)*/
+	uint32_t parent;
+
+	/**@brief   Name hash*/
+	uint32_t hash;
+
+	/**@brief   Entry inode (0 - negative entry, name does not exist)*/
+	uint32_t inode;
+
+	/**@brief   Entry inode type (EXT4_INODE_MODE_*)*/
+	uint32_t imode;
+
+	/**@brief   LRU stamp, smallest is evicted first*/
+	uint32_t lru;
+
+	/**@brief   Name length*/
+	uint8_t name_len;
+
+	/**@brief   Name (not null terminated)*/
+	char name[CONFIG_EXT4_DCACHE_NAME_LEN];
+};
+
+/**@brief   Directory entry cache descriptor.*/
+struct ext4_dcache {
+#if CONFIG_EXT4_DCACHE_SIZE
+	/**@brief   Entries*/
+	struct ext4_dcache_entry entry[CONFIG_EXT4_DCACHE_SIZE];
+#endif
+
+	/**@brief   LRU counter*/
+	uint32_t lru_ctr;
+};
+
+/**@brief   Drop all entries.
+ * @param   dc dentry cache*/
+void ext4_dcache_init(struct ext4_dcache *dc);
+
+/**@brief   Look up a name in a directory.
+ * @param   dc dentry cache
+ * @param   parent directory inode
+ * @param   name entry name
+ * @param   len entry name length
+ * @param   inode output entry inode (0 - name does not exist)
+ * @param   imode output entry inode type
+ * @return  true if the cache holds an answer*/
+bool ext4_dcache_lookup(struct ext4_dcache *dc, uint32_t parent,
+			const char *name, uint32_t len, uint32_t *inode,
+			uint32_t *imode);
+
+/**@brief   Remember a lookup result. Evicts the least recently used entry
+ *          when full. "." and ".." and names longer than
+ *          CONFIG_EXT4_DCACHE_NAME_LEN are not cached.
+ * @param   dc dentry cache
+ * @param   parent directory inode
+ * @param   name entry name
+ * @param   len entry name length
+ * @param   inode entry inode (0 - name does not exist)
+ * @param   imode entry inode type*/
+void ext4_dcache_insert(struct ext4_dcache *dc, uint32_t parent,
+			const char *name, uint32_t len, uint32_t inode,
+			uint32_t imode);
+
+/**@brief   Forget a name (link, unlink, rename).
+ * @param   dc dentry cache
+ * @param   parent directory inode
+ * @param   name entry name
+ * @param   len entry name length*/
+void ext4_dcache_remove(struct ext4_dcache *dc, uint32_t parent,
+			const char *name, uint32_t len);
+
+/**@brief   Forget all names of a directory (directory removed, its inode
+ *          number may be reused).
+ * @param   dc dentry cache
+ * @param   parent directory inode*/
+void ext4_dcache_purge_dir(struct ext4_dcache *dc, uint32_t parent);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EXT4_DCACHE_H_ */
+
+/**
+ * @}
+ */
@@ -77,8 +77,7 @@ ext4_dir_get_tail(struct ext4_inode_ref *inode_ref,
 }
 
 #if CONFIG_META_CSUM_ENABLE
-static uint32_t ext4_dir_csum(struct ext4_inode_ref *inode_ref,
-			      struct ext4_dir_en *dirent, int size)
+static uint32_t ext4_dir_csum_seed(struct ext4_inode_ref *inode_ref)
 {
 	uint32_t csum;
 	struct ext4_sblock *sb = &inode_ref->fs->sb;
@@ -91,11 +90,17 @@ static uint32_t ext4_dir_csum(struct ext4_inode_ref *inode_ref,
 	 * and inode generation */
 	csum = ext4_crc32c(csum, &ino_index, sizeof(ino_index));
 	csum = ext4_crc32c(csum, &ino_gen, sizeof(ino_gen));
-	/* Finally calculate crc32 checksum against directory entries */
-	csum = ext4_crc32c(csum, dirent, size);
 	return csum;
 }
+
+static uint32_t ext4_dir_csum(struct ext4_inode_ref *inode_ref,
+			      struct ext4_dir_en *dirent, int size)
+{
+	/* Finally calculate crc32 checksum against directory entries */
+	return ext4_crc32c(ext4_dir_csum_seed(inode_ref), dirent, size);
+}
 #else
+#define ext4_dir_csum_seed(...) 0
 #define ext4_dir_csum(...) 0
 #endif
 
@@ -124,6 +129,19 @@ bool ext4_dir_csum_verify(struct ext4_inode_ref *inode_ref,
 	return true;
 }
 
+bool ext4_dir_block_csum_verify(struct ext4_inode_ref *inode_ref,
+				struct ext4_block *b)
+{
+	if (ext4_bcache_test_verified(b->buf, EXT4_BCACHE_VERIFIED_BLOCK))
+		return true;
+
+	if (!ext4_dir_csum_verify(inode_ref, (void *)b->data))
+		return false;
+
+	ext4_bcache_set_verified(b->buf, EXT4_BCACHE_VERIFIED_BLOCK);
+	return true;
+}
+
 void ext4_dir_init_entry_tail(struct ext4_dir_entry_tail *t)
 {
 	memset(t, 0, sizeof(struct ext4_dir_entry_tail));
@@ -151,6 +169,35 @@ void ext4_dir_set_csum(struct ext4_inode_ref *inode_ref,
 	}
 }
 
+/**@brief Deferred checksum of a directory block, csum_id holds the
+ *        checksum seed of the directory.*/
+static void ext4_dir_csum_pending(struct ext4_buf *buf, void *arg)
+{
+	struct ext4_inode_ref dir = {.fs = arg};
+	struct ext4_dir_entry_tail *t;
+
+	t = ext4_dir_get_tail(&dir, (void *)buf->data);
+	if (!t)
+		return;
+
+	t->checksum = to_le32(ext4_crc32c(buf->csum_id, buf->data,
+					  (uint8_t *)t - buf->data));
+}
+
+void ext4_dir_block_set_csum(struct ext4_inode_ref *inode_ref,
+			     struct ext4_block *b)
+{
+	if (!ext4_fs_csum_deferred(inode_ref->fs)) {
+		ext4_dir_set_csum(inode_ref, (void *)b->data);
+		return;
+	}
+
+	ext4_bcache_set_csum_pending(b->buf, ext4_dir_csum_pending,
+				     inode_ref->fs,
+				     ext4_dir_csum_seed(inode_ref),
+				     EXT4_BCACHE_VERIFIED_BLOCK);
+}
+
 /**@brief Do some checks before returning iterator.
  * @param it Iterator to be checked
  * @param block_size Size of data block
@@ -383,7 +430,7 @@ int ext4_dir_add_entry(struct ext4_inode_ref *parent, const char *name,
 		if (r != EOK)
 			return r;
 
-		if (!ext4_dir_csum_verify(parent, (void *)block.data)) {
+		if (!ext4_dir_block_csum_verify(parent, &block)) {
 			ext4_dbg(DEBUG_DIR,
 				 DBG_WARN "Leaf block checksum failed."
 				 "Inode: %" PRIu32", "
@@ -435,7 +482,7 @@ int ext4_dir_add_entry(struct ext4_inode_ref *parent, const char *name,
 				name_len);
 	}
 
-	ext4_dir_set_csum(parent, (void *)b.data);
+	ext4_dir_block_set_csum(parent, &b);
 	ext4_trans_set_block_dirty(b.buf);
 	r = ext4_block_set(fs->bdev, &b);
 
@@ -494,7 +541,7 @@ int ext4_dir_find_entry(struct ext4_dir_search_result *result,
 		if (r != EOK)
 			return r;
 
-		if (!ext4_dir_csum_verify(parent, (void *)b.data)) {
+		if (!ext4_dir_block_csum_verify(parent, &b)) {
 			ext4_dbg(DEBUG_DIR,
 				 DBG_WARN "Leaf block checksum failed."
 				 "Inode: %" PRIu32", "
@@ -568,8 +615,7 @@ int ext4_dir_remove_entry(struct ext4_inode_ref *parent, const char *name,
 		ext4_dir_en_set_entry_len(tmp_de, de_len + del_len);
 	}
 
-	ext4_dir_set_csum(parent,
-			(struct ext4_dir_en *)result.block.data);
+	ext4_dir_block_set_csum(parent, &result.block);
 	ext4_trans_set_block_dirty(result.block.buf);
 
 	return ext4_dir_destroy_result(parent, &result);
@@ -606,7 +652,7 @@ int ext4_dir_try_insert_entry(struct ext4_sblock *sb,
 		    (rec_len >= required_len)) {
 			ext4_dir_write_entry(sb, start, rec_len, child, name,
 					     name_len);
-			ext4_dir_set_csum(inode_ref, (void *)dst_blk->data);
+			ext4_dir_block_set_csum(inode_ref, dst_blk);
 			ext4_trans_set_block_dirty(dst_blk->buf);
 
 			return EOK;
@@ -634,8 +680,7 @@ int ext4_dir_try_insert_entry(struct ext4_sblock *sb,
 				ext4_dir_write_entry(sb, new_entry, free_space,
 						     child, name, name_len);
 
-				ext4_dir_set_csum(inode_ref,
-						  (void *)dst_blk->data);
+				ext4_dir_block_set_csum(inode_ref, dst_blk);
 				ext4_trans_set_block_dirty(dst_blk->buf);
 				return EOK;
 			}
@@ -184,6 +184,15 @@ static inline void ext4_dir_en_set_inode_type(struct ext4_sblock *sb,
 bool ext4_dir_csum_verify(struct ext4_inode_ref *inode_ref,
 			  struct ext4_dir_en *dirent);
 
+/**@brief Verify checksum of a cached linear directory leaf block, once
+ *        per read of the block from the device
+ * @param inode_ref Directory i-node
+ * @param b         Linear directory leaf block
+ * @return true means the block passed checksum verification
+ */
+bool ext4_dir_block_csum_verify(struct ext4_inode_ref *inode_ref,
+				struct ext4_block *b);
+
 /**@brief Initialize directory iterator.
  * Set position to the first valid entry from the required position.
  * @param it        Pointer to iterator to be initialized
@@ -287,6 +296,14 @@ int ext4_dir_destroy_result(struct ext4_inode_ref *parent,
 void ext4_dir_set_csum(struct ext4_inode_ref *inode_ref,
 		       struct ext4_dir_en *dirent);
 
+/**@brief Set the checksum of a changed directory leaf block, now or when
+ *        the block is written back (@ref ext4_fs_csum_deferred).
+ * @param inode_ref Directory i-node
+ * @param b         Linear directory leaf block
+ */
+void ext4_dir_block_set_csum(struct ext4_inode_ref *inode_ref,
+			     struct ext4_block *b);
+
 
 void ext4_dir_init_entry_tail(struct ext4_dir_entry_tail *t);
 
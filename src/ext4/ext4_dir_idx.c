@@ -439,12 +439,12 @@ int ext4_dir_dx_init(struct ext4_inode_ref *dir, struct ext4_inode_ref *parent)
 		ext4_dir_en_set_name_len(sb, be, 0);
 		ext4_dir_en_set_inode_type(sb, be, EXT4_DE_UNKNOWN);
 		ext4_dir_init_entry_tail(EXT4_DIRENT_TAIL(be, block_size));
-		ext4_dir_set_csum(dir, be);
 	} else {
 		ext4_dir_en_set_entry_len(be, block_size);
 	}
 
 	ext4_dir_en_set_inode(be, 0);
+	ext4_dir_block_set_csum(dir, &new_block);
 
 	ext4_trans_set_block_dirty(new_block.buf);
 	rc = ext4_block_set(dir->fs->bdev, &new_block);
@@ -778,7 +778,7 @@ int ext4_dir_dx_find_entry(struct ext4_dir_search_result *result,
 		if (rc != EOK)
 			goto cleanup;
 
-		if (!ext4_dir_csum_verify(inode_ref, (void *)b.data)) {
+		if (!ext4_dir_block_csum_verify(inode_ref, &b)) {
 			ext4_dbg(DEBUG_DIR_IDX,
 				 DBG_WARN "HTree leaf block checksum failed."
 				 "Inode: %" PRIu32", "
@@ -1051,8 +1051,8 @@ static int ext4_dir_dx_split_data(struct ext4_inode_ref *inode_ref,
 		t = EXT4_DIRENT_TAIL(new_data_block_tmp.data, block_size);
 		ext4_dir_init_entry_tail(t);
 	}
-	ext4_dir_set_csum(inode_ref, (void *)old_data_block->data);
-	ext4_dir_set_csum(inode_ref, (void *)new_data_block_tmp.data);
+	ext4_dir_block_set_csum(inode_ref, old_data_block);
+	ext4_dir_block_set_csum(inode_ref, &new_data_block_tmp);
 	ext4_trans_set_block_dirty(old_data_block->buf);
 	ext4_trans_set_block_dirty(new_data_block_tmp.buf);
 
@@ -1299,7 +1299,7 @@ int ext4_dir_dx_add_entry(struct ext4_inode_ref *parent,
 	if (r != EOK)
 		goto release_index;
 
-	if (!ext4_dir_csum_verify(parent,(void *)target_block.data)) {
+	if (!ext4_dir_block_csum_verify(parent, &target_block)) {
 		ext4_dbg(DEBUG_DIR_IDX,
 				DBG_WARN "HTree leaf block checksum failed."
 				"Inode: %" PRIu32", "
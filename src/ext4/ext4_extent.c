@@ -493,6 +493,7 @@ static int ext4_allocate_single_block(struct ext4_inode_ref *inode_ref,
 	return ext4_balloc_alloc_block(inode_ref, goal, blockp);
 }
 
+/* count: in - most blocks wanted (NULL - one block), out - allocated */
 static ext4_fsblk_t ext4_new_meta_blocks(struct ext4_inode_ref *inode_ref,
 					 ext4_fsblk_t goal,
 					 uint32_t flags __unused,
@@ -500,9 +501,15 @@ static ext4_fsblk_t ext4_new_meta_blocks(struct ext4_inode_ref *inode_ref,
 {
 	ext4_fsblk_t block = 0;
 
-	*errp = ext4_allocate_single_block(inode_ref, goal, &block);
-	if (count)
-		*count = 1;
+	if (!count || *count <= 1) {
+		*errp = ext4_allocate_single_block(inode_ref, goal, &block);
+		if (count)
+			*count = 1;
+		return block;
+	}
+
+	*errp = ext4_balloc_alloc_blocks(inode_ref, goal, *count, &block,
+					 count);
 	return block;
 }
 
@@ -728,9 +735,10 @@ static void ext4_ext_drop_refs(struct ext4_inode_ref *inode_ref,
  * is correct or not.
  */
 static int ext4_ext_check(struct ext4_inode_ref *inode_ref,
-			  struct ext4_extent_header *eh, uint16_t depth,
+			  struct ext4_block *bh, uint16_t depth,
 			  ext4_fsblk_t pblk __unused)
 {
+	struct ext4_extent_header *eh = ext_block_hdr(bh);
 	struct ext4_extent_tail *tail;
 	struct ext4_sblock *sb = &inode_ref->fs->sb;
 	const char *error_msg;
@@ -754,13 +762,17 @@ static int ext4_ext_check(struct ext4_inode_ref *inode_ref,
 	}
 
 	tail = find_ext4_extent_tail(eh);
-	if (ext4_sb_feature_ro_com(sb, EXT4_FRO_COM_METADATA_CSUM)) {
+	if (ext4_sb_feature_ro_com(sb, EXT4_FRO_COM_METADATA_CSUM) &&
+	    !ext4_bcache_test_verified(bh->buf, EXT4_BCACHE_VERIFIED_BLOCK)) {
 		if (tail->et_checksum !=
 		    to_le32(ext4_ext_block_csum(inode_ref, eh))) {
 			ext4_dbg(DEBUG_EXTENT,
 				 DBG_WARN "Extent block checksum failed."
 					  "Blocknr: %" PRIu64 "\n",
 				 pblk);
+		} else {
+			ext4_bcache_set_verified(bh->buf,
+						 EXT4_BCACHE_VERIFIED_BLOCK);
 		}
 	}
 
@@ -784,7 +796,7 @@ static int read_extent_tree_block(struct ext4_inode_ref *inode_ref,
 	if (err != EOK)
 		goto errout;
 
-	err = ext4_ext_check(inode_ref, ext_block_hdr(bh), depth, pblk);
+	err = ext4_ext_check(inode_ref, bh, depth, pblk);
 	if (err != EOK)
 		goto errout;
 
@@ -1194,6 +1206,10 @@ static int ext4_ext_correct_indexes(struct ext4_inode_ref *inode_ref,
 static inline bool ext4_ext_can_prepend(struct ext4_extent *ex1,
 					struct ext4_extent *ex2)
 {
+	/* never mix written and unwritten blocks */
+	if (ext4_ext_is_unwritten(ex1) != ext4_ext_is_unwritten(ex2))
+		return 0;
+
 	if (ext4_ext_pblock(ex2) + ext4_ext_get_actual_len(ex2) !=
 	    ext4_ext_pblock(ex1))
 		return 0;
@@ -1222,6 +1238,9 @@ static inline bool ext4_ext_can_prepend(struct ext4_extent *ex1,
 static inline bool ext4_ext_can_append(struct ext4_extent *ex1,
 				       struct ext4_extent *ex2)
 {
+	if (ext4_ext_is_unwritten(ex1) != ext4_ext_is_unwritten(ex2))
+		return 0;
+
 	if (ext4_ext_pblock(ex1) + ext4_ext_get_actual_len(ex1) !=
 	    ext4_ext_pblock(ex2))
 		return 0;
@@ -1280,12 +1299,18 @@ static int ext4_ext_insert_leaf(struct ext4_inode_ref *inode_ref,
 		    ext4_ext_can_prepend(curp->extent, newext)) {
 			unwritten = ext4_ext_is_unwritten(curp->extent);
 			curp->extent->first_block = newext->first_block;
+			ext4_ext_store_pblock(curp->extent,
+					      ext4_ext_pblock(newext));
 			curp->extent->block_count =
 			    to_le16(ext4_ext_get_actual_len(curp->extent) +
 				    ext4_ext_get_actual_len(newext));
 			if (unwritten)
 				ext4_ext_mark_unwritten(curp->extent);
 
+			/* The extent now starts lower, so may the leaf */
+			err = ext4_ext_correct_indexes(inode_ref, path);
+			if (err != EOK)
+				goto out;
 			err = ext4_ext_dirty(inode_ref, curp);
 			goto out;
 		}
@@ -1600,6 +1625,15 @@ static int ext4_ext_remove_leaf(struct ext4_inode_ref *inode_ref,
 		new_start = start = to_le32(ex->first_block);
 		len = ext4_ext_get_actual_len(ex);
 		newblock = ext4_ext_pblock(ex);
+		/*
+		 * The extent ends before the range, the range starts in a
+		 * hole. Keep it as it is.
+		 */
+		if (start + len - 1 < from) {
+			start_ex++;
+			ex++;
+			continue;
+		}
 		/*
 		 * The 1st case:
 		 *   The position that we start truncation is inside the range of an
@@ -1709,6 +1743,8 @@ int ext4_extent_remove_space(struct ext4_inode_ref *inode_ref, ext4_lblk_t from,
 	int32_t depth = ext_depth(inode_ref->inode);
 	int32_t i;
 
+	inode_ref->fs->map_gen++;
+
 	ret = ext4_find_extent(inode_ref, from, &path, 0);
 	if (ret != EOK)
 		goto out;
@@ -1718,14 +1754,6 @@ int ext4_extent_remove_space(struct ext4_inode_ref *inode_ref, ext4_lblk_t from,
 		goto out;
 	}
 
-	bool in_range = IN_RANGE(from, to_le32(path[depth].extent->first_block),
-				 ext4_ext_get_actual_len(path[depth].extent));
-
-	if (!in_range) {
-		ret = EOK;
-		goto out;
-	}
-
 	/* If we do remove_space inside the range of an extent */
 	if ((to_le32(path[depth].extent->first_block) < from) &&
 	    (to < to_le32(path[depth].extent->first_block) +
@@ -1750,6 +1778,10 @@ int ext4_extent_remove_space(struct ext4_inode_ref *inode_ref, ext4_lblk_t from,
 			ext4_ext_mark_unwritten(&newex);
 
 		ret = ext4_ext_insert_extent(inode_ref, &path, &newex, 0);
+		if (ret == EOK)
+			ext4_ext_free_blocks(inode_ref,
+					     newblock - (to + 1 - from),
+					     to + 1 - from, 0);
 		goto out;
 	}
 
@@ -1900,6 +1932,50 @@ restore_extent_len:
 	return err;
 }
 
+/*
+ * Merge the extent starting at lblk with its neighbours in the leaf of the
+ * path. Extents are never removed from the front of the leaf, so the
+ * indexes above stay valid.
+ */
+static int ext4_ext_try_to_merge(struct ext4_inode_ref *inode_ref,
+				 struct ext4_extent_path *path,
+				 ext4_lblk_t lblk)
+{
+	int32_t depth = ext_depth(inode_ref->inode);
+	struct ext4_extent_header *eh = path[depth].header;
+	struct ext4_extent *ex = path[depth].extent;
+	struct ext4_extent *last;
+	int32_t len;
+
+	/* the initialized part may be right before the extent the path
+	 * points to, or in another leaf after a node split */
+	if (ex && to_le32(ex->first_block) != lblk) {
+		ex = (ex > EXT_FIRST_EXTENT(eh)) ? ex - 1 : NULL;
+		if (ex && to_le32(ex->first_block) != lblk)
+			ex = NULL;
+	}
+	if (!ex)
+		return EOK;
+
+	if (ex > EXT_FIRST_EXTENT(eh) && ext4_ext_can_append(ex - 1, ex))
+		ex--;
+
+	last = EXT_LAST_EXTENT(eh);
+	while (ex < last && ext4_ext_can_append(ex, ex + 1)) {
+		len = ext4_ext_get_actual_len(ex) +
+		      ext4_ext_get_actual_len(ex + 1);
+		ex->block_count = to_le16(len);
+		if (ex + 1 < last)
+			memmove(ex + 1, ex + 2,
+				(last - ex - 1) * sizeof(struct ext4_extent));
+		eh->entries_count = to_le16(to_le16(eh->entries_count) - 1);
+		last--;
+	}
+
+	path[depth].extent = ex;
+	return ext4_ext_dirty(inode_ref, path + depth);
+}
+
 static int ext4_ext_convert_to_initialized(struct ext4_inode_ref *inode_ref,
 					   struct ext4_extent_path **ppath,
 					   ext4_lblk_t split, uint32_t blocks)
@@ -1919,16 +1995,23 @@ static int ext4_ext_convert_to_initialized(struct ext4_inode_ref *inode_ref,
 		err = ext4_ext_split_extent_at(inode_ref, ppath, split + blocks,
 					       EXT4_EXT_MARK_UNWRIT2);
 	} else {
-		/* split 1 extent to 3 and initialize the 2nd */
-		err = ext4_ext_split_extent_at(inode_ref, ppath, split + blocks,
+		/* split 1 extent to 3 and initialize the 2nd. The path
+		 * points to the inserted right part after a split, so
+		 * split off the left part first. */
+		err = ext4_ext_split_extent_at(inode_ref, ppath, split,
 					       EXT4_EXT_MARK_UNWRIT1 |
 						   EXT4_EXT_MARK_UNWRIT2);
 		if (err == EOK) {
-			err = ext4_ext_split_extent_at(inode_ref, ppath, split,
-						       EXT4_EXT_MARK_UNWRIT1);
+			err = ext4_ext_split_extent_at(inode_ref, ppath,
+						       split + blocks,
+						       EXT4_EXT_MARK_UNWRIT2);
 		}
 	}
 
+	/* a run converted piece by piece stays one extent */
+	if (err == EOK)
+		err = ext4_ext_try_to_merge(inode_ref, *ppath, split);
+
 	return err;
 }
 
@@ -2014,6 +2097,18 @@ int ext4_extent_get_blocks(struct ext4_inode_ref *inode_ref, ext4_lblk_t iblock,
 			   uint32_t max_blocks, ext4_fsblk_t *result,
 			   bool create, uint32_t *blocks_count)
 {
+	return ext4_extent_map_blocks(inode_ref, iblock, max_blocks, result,
+				      create ? EXT4_EXT_MAP_CREATE : 0,
+				      blocks_count);
+}
+
+int ext4_extent_map_blocks(struct ext4_inode_ref *inode_ref, ext4_lblk_t iblock,
+			   uint32_t max_blocks, ext4_fsblk_t *result,
+			   uint32_t flags, uint32_t *blocks_count)
+{
+	bool create = flags & (EXT4_EXT_MAP_CREATE | EXT4_EXT_MAP_UNWRIT);
+	uint32_t max_len = (flags & EXT4_EXT_MAP_UNWRIT) ?
+			   EXT_UNWRITTEN_MAX_LEN : EXT_INIT_MAX_LEN;
 	struct ext4_extent_path *path = NULL;
 	struct ext4_extent newex, *ex;
 	ext4_fsblk_t goal;
@@ -2063,16 +2158,24 @@ int ext4_extent_get_blocks(struct ext4_inode_ref *inode_ref, ext4_lblk_t iblock,
 				goto out;
 			}
 
+			/* already preallocated */
+			if (flags & EXT4_EXT_MAP_UNWRIT) {
+				newblock = iblock - ee_block + ee_start;
+				goto out;
+			}
+
 			uint32_t zero_range;
 			zero_range = allocated;
 			if (zero_range > max_blocks)
 				zero_range = max_blocks;
 
 			newblock = iblock - ee_block + ee_start;
-			err = ext4_ext_zero_unwritten_range(inode_ref, newblock,
-							    zero_range);
-			if (err != EOK)
-				goto out2;
+			if (!(flags & EXT4_EXT_MAP_NOZERO)) {
+				err = ext4_ext_zero_unwritten_range(
+				    inode_ref, newblock, zero_range);
+				if (err != EOK)
+					goto out2;
+			}
 
 			err = ext4_ext_convert_to_initialized(
 			    inode_ref, &path, iblock, zero_range);
@@ -2083,20 +2186,30 @@ int ext4_extent_get_blocks(struct ext4_inode_ref *inode_ref, ext4_lblk_t iblock,
 		}
 	}
 
+	/* find next allocated block so that we know how many
+	 * blocks we can allocate without ovelapping next extent
+	 * (the leaf extent found may start after iblock) */
+	if (ex && to_le32(ex->first_block) > iblock)
+		next = to_le32(ex->first_block);
+	else
+		next = ext4_ext_next_allocated_block(path);
+	allocated = next - iblock;
+	if (allocated > max_blocks)
+		allocated = max_blocks;
+
 	/*
 	 * requested block isn't allocated yet
 	 * we couldn't try to create block if create flag is zero
 	 */
 	if (!create) {
+		/* report the size of the hole to the caller */
+		if (blocks_count)
+			*blocks_count = allocated;
 		goto out2;
 	}
 
-	/* find next allocated block so that we know how many
-	 * blocks we can allocate without ovelapping next extent */
-	next = ext4_ext_next_allocated_block(path);
-	allocated = next - iblock;
-	if (allocated > max_blocks)
-		allocated = max_blocks;
+	if (allocated > max_len)
+		allocated = max_len;
 
 	/* allocate new block */
 	goal = ext4_ext_find_goal(inode_ref, path, iblock);
@@ -2108,11 +2221,13 @@ int ext4_extent_get_blocks(struct ext4_inode_ref *inode_ref, ext4_lblk_t iblock,
 	newex.first_block = to_le32(iblock);
 	ext4_ext_store_pblock(&newex, newblock);
 	newex.block_count = to_le16(allocated);
+	if (flags & EXT4_EXT_MAP_UNWRIT)
+		ext4_ext_mark_unwritten(&newex);
 	err = ext4_ext_insert_extent(inode_ref, &path, &newex, 0);
 	if (err != EOK) {
 		/* free data blocks we just allocated */
 		ext4_ext_free_blocks(inode_ref, ext4_ext_pblock(&newex),
-				     to_le16(newex.block_count), 0);
+				     allocated, 0);
 		goto out2;
 	}
 
@@ -50,11 +50,41 @@ extern "C" {
 
 void ext4_extent_tree_init(struct ext4_inode_ref *inode_ref);
 
-
+/**@brief Map (and optionally allocate) a run of logical blocks.
+ * @param inode_ref    I-node to map blocks of
+ * @param iblock       First logical block
+ * @param max_blocks   Most blocks to map
+ * @param result       Output physical block of iblock (0 - hole or
+ *                     unwritten extent and create is false)
+ * @param create       Allocate a hole / initialize an unwritten extent
+ * @param blocks_count Output number of blocks from iblock that map to
+ *                     consecutive physical blocks (or are all unmapped)
+ * @return Error code */
 int ext4_extent_get_blocks(struct ext4_inode_ref *inode_ref, ext4_lblk_t iblock,
 			   uint32_t max_blocks, ext4_fsblk_t *result, bool create,
 			   uint32_t *blocks_count);
 
+/* ext4_extent_map_blocks() flags */
+#define EXT4_EXT_MAP_CREATE 0x01  /* allocate holes, initialize unwritten */
+#define EXT4_EXT_MAP_NOZERO 0x02  /* caller overwrites every block mapped,
+				     do not zero unwritten blocks */
+#define EXT4_EXT_MAP_UNWRIT 0x04  /* allocate holes as unwritten extents,
+				     leave mapped blocks as they are */
+
+/**@brief Like @ref ext4_extent_get_blocks with EXT4_EXT_MAP_* flags.
+ *        With EXT4_EXT_MAP_UNWRIT result is the first block of the run
+ *        and blocks_count the blocks skipped or preallocated.
+ * @param inode_ref    I-node to map blocks of
+ * @param iblock       First logical block
+ * @param max_blocks   Most blocks to map
+ * @param result       Output physical block of iblock
+ * @param flags        EXT4_EXT_MAP_* flags (0 - lookup only)
+ * @param blocks_count Output number of blocks from iblock in the run
+ * @return Error code */
+int ext4_extent_map_blocks(struct ext4_inode_ref *inode_ref, ext4_lblk_t iblock,
+			   uint32_t max_blocks, ext4_fsblk_t *result,
+			   uint32_t flags, uint32_t *blocks_count);
+
 
 /**@brief Release all data blocks starting from specified logical block.
  * @param inode_ref   I-node to release blocks from
@@ -67,6 +67,9 @@ int ext4_fs_init(struct ext4_fs *fs, struct ext4_blockdev *bdev,
 
 	ext4_assert(fs && bdev);
 	fs->bdev = bdev;
+	fs->bgd = NULL;
+	fs->bgd_dirty = 0;
+	fs->bgd_tried = false;
 
 	fs->read_only = read_only;
 	r = ext4_sb_read(fs->bdev, &fs->sb);
@@ -122,8 +125,20 @@ int ext4_fs_init(struct ext4_fs *fs, struct ext4_blockdev *bdev,
 
 int ext4_fs_fini(struct ext4_fs *fs)
 {
+	int r;
 	ext4_assert(fs);
 
+	if (fs->bgd) {
+		/* Deferred bitmap checksums need the table */
+		ext4_bcache_csum_update_dirty(fs->bdev->bc);
+		r = ext4_fs_bgd_sync(fs);
+		ext4_free(fs->bgd);
+		fs->bgd = NULL;
+		fs->bgd_tried = false;
+		if (r != EOK)
+			return r;
+	}
+
 	/*Set superblock state*/
 	ext4_set16(&fs->sb, state, EXT4_SUPERBLOCK_STATE_VALID_FS);
 
@@ -564,8 +579,36 @@ static bool ext4_fs_verify_bg_csum(struct ext4_sblock *sb,
 #define ext4_fs_verify_bg_csum(...) true
 #endif
 
-int ext4_fs_get_block_group_ref(struct ext4_fs *fs, uint32_t bgid,
-				struct ext4_block_group_ref *ref)
+/**@brief Allocate the in-memory descriptor table on first use.
+ * @return true if the table can be used*/
+static bool ext4_fs_bgd_table(struct ext4_fs *fs)
+{
+#if CONFIG_EXT4_BGD_TABLE_MAX
+	if (!fs->bgd_tried) {
+		uint32_t cnt = ext4_block_group_cnt(&fs->sb);
+		size_t dsz = ext4_sb_get_desc_size(&fs->sb);
+		size_t size = (size_t)cnt * (dsz + sizeof(uint32_t) + 1);
+
+		fs->bgd_tried = true;
+		fs->bgd_dirty = 0;
+		if (size <= CONFIG_EXT4_BGD_TABLE_MAX)
+			fs->bgd = ext4_calloc(1, size);
+		if (fs->bgd) {
+			fs->bgd_owner = (uint32_t *)(fs->bgd + cnt * dsz);
+			fs->bgd_state = (uint8_t *)(fs->bgd_owner + cnt);
+		}
+	}
+	return fs->bgd != NULL;
+#else
+	(void)fs;
+	return false;
+#endif
+}
+
+/**@brief Get the descriptor block of a group.
+ * @param offset output offset of the descriptor in the block*/
+static int ext4_fs_bgd_block_get(struct ext4_fs *fs, uint32_t bgid,
+				 struct ext4_block *b, uint32_t *offset)
 {
 	/* Compute number of descriptors, that fits in one data block */
 	uint32_t block_size = ext4_sb_get_block_size(&fs->sb);
@@ -575,29 +618,320 @@ int ext4_fs_get_block_group_ref(struct ext4_fs *fs, uint32_t bgid,
 	 * superblock */
 	uint64_t block_id = ext4_fs_get_descriptor_block(&fs->sb, bgid, dsc_cnt);
 
-	uint32_t offset = (bgid % dsc_cnt) * ext4_sb_get_desc_size(&fs->sb);
+	*offset = (bgid % dsc_cnt) * ext4_sb_get_desc_size(&fs->sb);
+
+	return ext4_trans_block_get(fs->bdev, b, block_id);
+}
+
+static void ext4_fs_bgd_verify(struct ext4_fs *fs, uint32_t bgid,
+			       struct ext4_bgroup *bg)
+{
+	if (!ext4_fs_verify_bg_csum(&fs->sb, bgid, bg)) {
+		ext4_dbg(DEBUG_FS,
+			 DBG_WARN "Block group descriptor checksum failed."
+			 "Block group index: %" PRIu32"\n",
+			 bgid);
+	}
+}
+
+/**@brief Copy a group descriptor into the table. The checksum is
+ *        verified once, here.*/
+static int ext4_fs_bgd_load(struct ext4_fs *fs, uint32_t bgid)
+{
+	struct ext4_block b;
+	uint32_t offset;
+	uint32_t dsz = ext4_sb_get_desc_size(&fs->sb);
+	uint8_t *bg = fs->bgd + (size_t)bgid * dsz;
+	int rc;
+
+	if (fs->bgd_state[bgid] & EXT4_FS_BGD_LOADED)
+		return EOK;
 
-	int rc = ext4_trans_block_get(fs->bdev, &ref->block, block_id);
+	rc = ext4_fs_bgd_block_get(fs, bgid, &b, &offset);
 	if (rc != EOK)
 		return rc;
 
-	ref->block_group = (void *)(ref->block.data + offset);
+	memcpy(bg, b.data + offset, dsz);
+	ext4_fs_bgd_verify(fs, bgid, (struct ext4_bgroup *)bg);
+	fs->bgd_state[bgid] |= EXT4_FS_BGD_LOADED;
+
+	return ext4_block_set(fs->bdev, &b);
+}
+
+/**@brief Remember a changed descriptor of the table and who changed it
+ *        (same rule as ext4_bcache_set_dirty).*/
+static void ext4_fs_bgd_set_dirty(struct ext4_fs *fs, uint32_t bgid,
+				  uint32_t owner)
+{
+	if (!(fs->bgd_state[bgid] & EXT4_FS_BGD_DIRTY)) {
+		fs->bgd_state[bgid] |= EXT4_FS_BGD_DIRTY;
+		fs->bgd_owner[bgid] = owner;
+		fs->bgd_dirty++;
+	} else if (!fs->bgd_owner[bgid]) {
+		fs->bgd_owner[bgid] = owner;
+	} else if (owner && fs->bgd_owner[bgid] != owner) {
+		fs->bgd_owner[bgid] = EXT4_BCACHE_OWNER_SHARED;
+	}
+}
+
+int ext4_fs_bgd_sync(struct ext4_fs *fs)
+{
+	struct ext4_bcache *bc = fs->bdev->bc;
+	uint32_t owner = bc->owner;
+	uint32_t cnt = ext4_block_group_cnt(&fs->sb);
+	uint32_t dsz = ext4_sb_get_desc_size(&fs->sb);
+	int rc = EOK;
+
+	for (uint32_t bgid = 0; bgid < cnt && fs->bgd_dirty; bgid++) {
+		struct ext4_bgroup *bg;
+		struct ext4_block b;
+		uint32_t offset;
+
+		if (!(fs->bgd_state[bgid] & EXT4_FS_BGD_DIRTY))
+			continue;
+
+		rc = ext4_fs_bgd_block_get(fs, bgid, &b, &offset);
+		if (rc != EOK)
+			break;
+
+		bg = (struct ext4_bgroup *)(fs->bgd + (size_t)bgid * dsz);
+		bg->checksum = to_le16(ext4_fs_bg_checksum(&fs->sb, bgid, bg));
+		memcpy(b.data + offset, bg, dsz);
+
+		/* Dirty the block on behalf of the inodes that changed it */
+		bc->owner = fs->bgd_owner[bgid];
+		ext4_trans_set_block_dirty(b.buf);
+		bc->owner = owner;
+
+		fs->bgd_state[bgid] &= ~EXT4_FS_BGD_DIRTY;
+		fs->bgd_dirty--;
+
+		rc = ext4_block_set(fs->bdev, &b);
+		if (rc != EOK)
+			break;
+	}
+	return rc;
+}
+
+void ext4_fs_bgd_drop(struct ext4_fs *fs)
+{
+	if (!fs->bgd)
+		return;
+
+	/* No deferred bitmap checksum may land in a dropped entry */
+	ext4_bcache_csum_update_dirty(fs->bdev->bc);
+
+	memset(fs->bgd_state, 0, ext4_block_group_cnt(&fs->sb));
+	fs->bgd_dirty = 0;
+}
+
+bool ext4_fs_csum_deferred(struct ext4_fs *fs)
+{
+#if CONFIG_EXT4_CSUM_DEFER
+	return fs->bdev->cache_write_back && !fs->jbd_journal &&
+	       ext4_sb_feature_ro_com(&fs->sb, EXT4_FRO_COM_METADATA_CSUM);
+#else
+	(void)fs;
+	return false;
+#endif
+}
+
+/**@brief Deferred bitmap checksum, stored in the table descriptor of the
+ *        group on behalf of the inodes that changed the bitmap.*/
+static void ext4_fs_bitmap_csum_pending(struct ext4_buf *buf, void *arg,
+					bool inode_bitmap)
+{
+	struct ext4_fs *fs = arg;
+	uint32_t bgid = buf->csum_id;
+	struct ext4_bgroup *bg = (void *)(fs->bgd + (size_t)bgid *
+					  ext4_sb_get_desc_size(&fs->sb));
+
+	if (inode_bitmap)
+		ext4_ialloc_set_bitmap_csum(&fs->sb, bg, buf->data);
+	else
+		ext4_balloc_set_bitmap_csum(&fs->sb, bg, buf->data);
+
+	ext4_fs_bgd_set_dirty(fs, bgid, buf->owner);
+}
+
+static void ext4_fs_block_bitmap_csum_pending(struct ext4_buf *buf, void *arg)
+{
+	ext4_fs_bitmap_csum_pending(buf, arg, false);
+}
+
+static void ext4_fs_inode_bitmap_csum_pending(struct ext4_buf *buf, void *arg)
+{
+	ext4_fs_bitmap_csum_pending(buf, arg, true);
+}
+
+/**@brief CRC32C change of a bitmap of size bytes whose bits
+ *        [first, first + cnt) all flipped.*/
+static uint32_t ext4_fs_bitmap_csum_delta(uint32_t first, uint32_t cnt,
+					  uint32_t size)
+{
+	uint8_t run[32];
+	uint32_t end = first + cnt;
+	uint32_t byte = first / 8;
+	uint32_t last = (end - 1) / 8;
+	uint32_t crc = 0;
+
+	while (byte <= last) {
+		uint32_t n = last - byte + 1;
+		uint32_t i;
+
+		if (n > sizeof(run))
+			n = sizeof(run);
+
+		for (i = 0; i < n; i++) {
+			uint32_t bit = (byte + i) * 8;
+			uint8_t m = 0xFF;
+
+			if (bit < first)
+				m &= 0xFF << (first - bit);
+			if (bit + 8 > end)
+				m &= 0xFF >> (bit + 8 - end);
+			run[i] = m;
+		}
+		crc = ext4_crc32c(crc, run, n);
+		byte += n;
+	}
+
+	return ext4_crc32c_zeros(crc, size - byte);
+}
+
+/**@brief Patch the bitmap checksum in a descriptor for the flipped bits
+ *        [first, first + cnt), instead of computing it over the whole
+ *        bitmap again. Only done while the descriptor is known to hold
+ *        the checksum of the bitmap before the change.
+ * @return true if patched, false if a full computation is needed*/
+static bool ext4_fs_bitmap_csum_patch(struct ext4_fs *fs, struct ext4_buf *buf,
+				      uint16_t *lo, uint16_t *hi,
+				      uint32_t first, uint32_t cnt,
+				      uint32_t size)
+{
+	bool csum32 = ext4_sb_get_desc_size(&fs->sb) ==
+		      EXT4_MAX_BLOCK_GROUP_DESCRIPTOR_SIZE;
+	uint32_t csum;
+
+	if (!cnt || buf->csum_pending ||
+	    !ext4_bcache_test_verified(buf, EXT4_BCACHE_VERIFIED_BLOCK))
+		return false;
+
+	csum = to_le16(*lo);
+	if (csum32)
+		csum |= (uint32_t)to_le16(*hi) << 16;
+
+	csum ^= ext4_fs_bitmap_csum_delta(first, cnt, size);
+
+	*lo = to_le16(csum & 0xFFFF);
+	if (csum32)
+		*hi = to_le16(csum >> 16);
+
+	return true;
+}
+
+void ext4_fs_set_block_bitmap_csum(struct ext4_block_group_ref *bg_ref,
+				   struct ext4_block *b,
+				   uint32_t first, uint32_t cnt)
+{
+	struct ext4_fs *fs = bg_ref->fs;
+	struct ext4_bgroup *bg = bg_ref->block_group;
+
+	if (!ext4_sb_feature_ro_com(&fs->sb, EXT4_FRO_COM_METADATA_CSUM))
+		return;
+
+	if (ext4_fs_bitmap_csum_patch(fs, b->buf, &bg->block_bitmap_csum_lo,
+				      &bg->block_bitmap_csum_hi, first, cnt,
+				      ext4_get32(&fs->sb, blocks_per_group) / 8))
+		return;
+
+	/* Or at write back, where only a table descriptor can be changed */
+	if (!bg_ref->block.buf && ext4_fs_csum_deferred(fs)) {
+		ext4_bcache_set_csum_pending(b->buf,
+					     ext4_fs_block_bitmap_csum_pending,
+					     fs, bg_ref->index,
+					     EXT4_BCACHE_VERIFIED_BLOCK);
+		return;
+	}
+
+	ext4_balloc_set_bitmap_csum(&fs->sb, bg, b->data);
+	ext4_bcache_set_verified(b->buf, EXT4_BCACHE_VERIFIED_BLOCK);
+}
+
+void ext4_fs_set_inode_bitmap_csum(struct ext4_block_group_ref *bg_ref,
+				   struct ext4_block *b,
+				   uint32_t first, uint32_t cnt)
+{
+	struct ext4_fs *fs = bg_ref->fs;
+	struct ext4_bgroup *bg = bg_ref->block_group;
+	uint32_t inodes_per_group = ext4_get32(&fs->sb, inodes_per_group);
+
+	if (!ext4_sb_feature_ro_com(&fs->sb, EXT4_FRO_COM_METADATA_CSUM))
+		return;
+
+	if (ext4_fs_bitmap_csum_patch(fs, b->buf, &bg->inode_bitmap_csum_lo,
+				      &bg->inode_bitmap_csum_hi, first, cnt,
+				      (inodes_per_group + 7) / 8))
+		return;
+
+	if (!bg_ref->block.buf && ext4_fs_csum_deferred(fs)) {
+		ext4_bcache_set_csum_pending(b->buf,
+					     ext4_fs_inode_bitmap_csum_pending,
+					     fs, bg_ref->index,
+					     EXT4_BCACHE_VERIFIED_BLOCK);
+		return;
+	}
+
+	ext4_ialloc_set_bitmap_csum(&fs->sb, bg, b->data);
+	ext4_bcache_set_verified(b->buf, EXT4_BCACHE_VERIFIED_BLOCK);
+}
+
+/**@brief Release the descriptor block of a reference, if it holds one.*/
+static void ext4_fs_bg_ref_release(struct ext4_block_group_ref *ref)
+{
+	if (ref->block.buf)
+		ext4_block_set(ref->fs->bdev, &ref->block);
+}
+
+int ext4_fs_get_block_group_ref(struct ext4_fs *fs, uint32_t bgid,
+				struct ext4_block_group_ref *ref)
+{
+	int rc;
+	uint32_t offset;
+
+	/* The table is indexed by bgid, a corrupted block number must not
+	 * read past it */
+	if (bgid >= ext4_block_group_cnt(&fs->sb))
+		return EIO;
+
 	ref->fs = fs;
 	ref->index = bgid;
 	ref->dirty = false;
-	struct ext4_bgroup *bg = ref->block_group;
 
-	if (!ext4_fs_verify_bg_csum(&fs->sb, bgid, bg)) {
-		ext4_dbg(DEBUG_FS,
-			 DBG_WARN "Block group descriptor checksum failed."
-			 "Block group index: %" PRIu32"\n",
-			 bgid);
+	if (ext4_fs_bgd_table(fs)) {
+		/* Served from the table, no block and no checksum */
+		rc = ext4_fs_bgd_load(fs, bgid);
+		if (rc != EOK)
+			return rc;
+
+		memset(&ref->block, 0, sizeof(ref->block));
+		ref->block_group = (void *)(fs->bgd + (size_t)bgid *
+					    ext4_sb_get_desc_size(&fs->sb));
+	} else {
+		rc = ext4_fs_bgd_block_get(fs, bgid, &ref->block, &offset);
+		if (rc != EOK)
+			return rc;
+
+		ref->block_group = (void *)(ref->block.data + offset);
+		ext4_fs_bgd_verify(fs, bgid, ref->block_group);
 	}
 
+	struct ext4_bgroup *bg = ref->block_group;
+
 	if (ext4_bg_has_flag(bg, EXT4_BLOCK_GROUP_BLOCK_UNINIT)) {
 		rc = ext4_fs_init_block_bitmap(ref);
 		if (rc != EOK) {
-			ext4_block_set(fs->bdev, &ref->block);
+			ext4_fs_bg_ref_release(ref);
 			return rc;
 		}
 		ext4_bg_clear_flag(bg, EXT4_BLOCK_GROUP_BLOCK_UNINIT);
@@ -607,7 +941,7 @@ int ext4_fs_get_block_group_ref(struct ext4_fs *fs, uint32_t bgid,
 	if (ext4_bg_has_flag(bg, EXT4_BLOCK_GROUP_INODE_UNINIT)) {
 		rc = ext4_fs_init_inode_bitmap(ref);
 		if (rc != EOK) {
-			ext4_block_set(ref->fs->bdev, &ref->block);
+			ext4_fs_bg_ref_release(ref);
 			return rc;
 		}
 
@@ -616,7 +950,7 @@ int ext4_fs_get_block_group_ref(struct ext4_fs *fs, uint32_t bgid,
 		if (!ext4_bg_has_flag(bg, EXT4_BLOCK_GROUP_ITABLE_ZEROED)) {
 			rc = ext4_fs_init_inode_table(ref);
 			if (rc != EOK) {
-				ext4_block_set(fs->bdev, &ref->block);
+				ext4_fs_bg_ref_release(ref);
 				return rc;
 			}
 
@@ -631,11 +965,27 @@ int ext4_fs_get_block_group_ref(struct ext4_fs *fs, uint32_t bgid,
 
 int ext4_fs_put_block_group_ref(struct ext4_block_group_ref *ref)
 {
+	struct ext4_fs *fs = ref->fs;
+
+	/* Table entry: the descriptor block and checksum are updated by
+	 * ext4_fs_bgd_sync, at write back. Without write back caching or
+	 * with the journal running that is right away, as before. */
+	if (!ref->block.buf) {
+		if (!ref->dirty)
+			return EOK;
+
+		ext4_fs_bgd_set_dirty(fs, ref->index, fs->bdev->bc->owner);
+		if (fs->bdev->cache_write_back && !fs->jbd_journal)
+			return EOK;
+
+		return ext4_fs_bgd_sync(fs);
+	}
+
 	/* Check if reference modified */
 	if (ref->dirty) {
 		/* Compute new checksum of block group */
 		uint16_t cs;
-		cs = ext4_fs_bg_checksum(&ref->fs->sb, ref->index,
+		cs = ext4_fs_bg_checksum(&fs->sb, ref->index,
 					 ref->block_group);
 		ref->block_group->checksum = to_le16(cs);
 
@@ -644,7 +994,7 @@ int ext4_fs_put_block_group_ref(struct ext4_block_group_ref *ref)
 	}
 
 	/* Put back block, that contains block group descriptor */
-	return ext4_block_set(ref->fs->bdev, &ref->block);
+	return ext4_block_set(fs->bdev, &ref->block);
 }
 
 #if CONFIG_META_CSUM_ENABLE
@@ -699,6 +1049,44 @@ static void ext4_fs_set_inode_checksum(struct ext4_inode_ref *inode_ref)
 	ext4_inode_set_csum(sb, inode_ref->inode, csum);
 }
 
+/**@brief Deferred checksums of the changed inodes of an inode table
+ *        block.*/
+static void ext4_fs_inode_csum_pending(struct ext4_buf *buf, void *arg)
+{
+	struct ext4_inode_ref ref = {.fs = arg};
+	uint16_t inode_size = ext4_get16(&ref.fs->sb, inode_size);
+
+	for (uint32_t slot = 0; buf->csum_units; slot++) {
+		uint32_t bit = UINT32_C(1) << slot;
+
+		if (!(buf->csum_units & bit))
+			continue;
+
+		buf->csum_units &= ~bit;
+		ref.index = buf->csum_id + slot;
+		ref.inode = (void *)(buf->data + slot * inode_size);
+		ext4_fs_set_inode_checksum(&ref);
+	}
+}
+
+/**@brief Set the checksum of a changed inode, now or when its inode
+ *        table block is written back.*/
+static void ext4_fs_inode_csum_update(struct ext4_inode_ref *ref)
+{
+	struct ext4_buf *buf = ref->block.buf;
+	uint16_t inode_size = ext4_get16(&ref->fs->sb, inode_size);
+	uint32_t slot = ((uint8_t *)ref->inode - ref->block.data) / inode_size;
+
+	if (slot >= 32 || !ext4_fs_csum_deferred(ref->fs)) {
+		ext4_fs_set_inode_checksum(ref);
+		return;
+	}
+
+	ext4_bcache_set_csum_pending(buf, ext4_fs_inode_csum_pending, ref->fs,
+				     ref->index - slot, slot);
+	buf->csum_units |= UINT32_C(1) << slot;
+}
+
 #if CONFIG_META_CSUM_ENABLE
 static bool ext4_fs_verify_inode_csum(struct ext4_inode_ref *inode_ref)
 {
@@ -770,11 +1158,17 @@ __ext4_fs_get_inode_ref(struct ext4_fs *fs, uint32_t index,
 	ref->fs = fs;
 	ref->dirty = false;
 
-	if (initialized && !ext4_fs_verify_inode_csum(ref)) {
-		ext4_dbg(DEBUG_FS,
-			DBG_WARN "Inode checksum failed."
-			"Inode: %" PRIu32"\n",
-			ref->index);
+	/* Each inode of the table block is verified once per read */
+	uint32_t slot = offset_in_block / inode_size;
+	if (initialized && !ext4_bcache_test_verified(ref->block.buf, slot)) {
+		if (ext4_fs_verify_inode_csum(ref)) {
+			ext4_bcache_set_verified(ref->block.buf, slot);
+		} else {
+			ext4_dbg(DEBUG_FS,
+				DBG_WARN "Inode checksum failed."
+				"Inode: %" PRIu32"\n",
+				ref->index);
+		}
 	}
 
 	return EOK;
@@ -791,7 +1185,7 @@ int ext4_fs_put_inode_ref(struct ext4_inode_ref *ref)
 	/* Check if reference modified */
 	if (ref->dirty) {
 		/* Mark block dirty for writing changes to physical device */
-		ext4_fs_set_inode_checksum(ref);
+		ext4_fs_inode_csum_update(ref);
 		ext4_trans_set_block_dirty(ref->block.buf);
 	}
 	/* Put back block, that contains i-node */
@@ -932,6 +1326,8 @@ int ext4_fs_free_inode(struct ext4_inode_ref *inode_ref)
 	uint32_t offset;
 	uint32_t suboff;
 	int rc;
+
+	fs->map_gen++;
 #if CONFIG_EXTENT_ENABLE
 	/* For extents must be data block destroyed by other way */
 	if ((ext4_sb_feature_incom(&fs->sb, EXT4_FINCOM_EXTENTS)) &&
@@ -1084,6 +1480,8 @@ static int ext4_fs_release_inode_block(struct ext4_inode_ref *inode_ref,
 	    ext4_sb_feature_incom(&fs->sb, EXT4_FINCOM_EXTENTS) &&
 	    (ext4_inode_has_flag(inode_ref->inode, EXT4_INODE_FLAG_EXTENTS))));
 
+	fs->map_gen++;
+
 	struct ext4_inode *inode = inode_ref->inode;
 
 	/* Handle simple case when we are dealing with direct reference */
@@ -1177,14 +1575,22 @@ int ext4_fs_truncate_inode(struct ext4_inode_ref *inode_ref, uint64_t new_size)
 	uint32_t i;
 	int r;
 	bool v;
+	bool extents = false;
 
 	/* Check flags, if i-node can be truncated */
 	if (!ext4_inode_can_truncate(sb, inode_ref->inode))
 		return EINVAL;
 
-	/* If sizes are equal, nothing has to be done. */
+#if CONFIG_EXTENT_ENABLE
+	extents = ext4_sb_feature_incom(sb, EXT4_FINCOM_EXTENTS) &&
+		  ext4_inode_has_flag(inode_ref->inode,
+				      EXT4_INODE_FLAG_EXTENTS);
+#endif
+
+	/* If sizes are equal, nothing has to be done. Extent mapped files
+	 * may have blocks preallocated past the end of file, these go. */
 	uint64_t old_size = ext4_inode_get_size(sb, inode_ref->inode);
-	if (old_size == new_size)
+	if (old_size == new_size && !extents)
 		return EOK;
 
 	/* It's not supported to make the larger file by truncate operation */
@@ -1221,17 +1627,14 @@ int ext4_fs_truncate_inode(struct ext4_inode_ref *inode_ref, uint64_t new_size)
 	uint32_t old_blocks_cnt = (uint32_t)((old_size + block_size - 1) / block_size);
 	uint32_t diff_blocks_cnt = old_blocks_cnt - new_blocks_cnt;
 #if CONFIG_EXTENT_ENABLE
-	if ((ext4_sb_feature_incom(sb, EXT4_FINCOM_EXTENTS)) &&
-	    (ext4_inode_has_flag(inode_ref->inode, EXT4_INODE_FLAG_EXTENTS))) {
+	if (extents) {
 
-		/* Extents require special operation */
-		if (diff_blocks_cnt) {
-			r = ext4_extent_remove_space(inode_ref, new_blocks_cnt,
-						     EXT_MAX_BLOCKS);
-			if (r != EOK)
-				return r;
-
-		}
+		/* Extents require special operation. Blocks preallocated
+		 * past the end of file go too. */
+		r = ext4_extent_remove_space(inode_ref, new_blocks_cnt,
+					     EXT_MAX_BLOCKS);
+		if (r != EOK)
+			return r;
 	} else
 #endif
 	{
@@ -1462,6 +1865,57 @@ int ext4_fs_get_inode_dblk_idx(struct ext4_inode_ref *inode_ref,
 						   false, support_unwritten);
 }
 
+int ext4_fs_get_inode_dblk_run(struct ext4_inode_ref *inode_ref,
+			       ext4_lblk_t iblock, uint32_t max_blocks,
+			       ext4_fsblk_t *fblock, uint32_t *blocks_count)
+{
+	int rc;
+	uint32_t cnt;
+	ext4_fsblk_t next;
+	struct ext4_fs *fs = inode_ref->fs;
+
+	ext4_assert(max_blocks);
+	*blocks_count = 1;
+
+	if (ext4_inode_get_size(&fs->sb, inode_ref->inode) == 0) {
+		*fblock = 0;
+		return EOK;
+	}
+
+#if CONFIG_EXTENT_ENABLE
+	/* One extent lookup maps the whole run */
+	if ((ext4_sb_feature_incom(&fs->sb, EXT4_FINCOM_EXTENTS)) &&
+	    (ext4_inode_has_flag(inode_ref->inode, EXT4_INODE_FLAG_EXTENTS))) {
+		rc = ext4_extent_get_blocks(inode_ref, iblock, max_blocks,
+					    fblock, false, &cnt);
+		if (rc != EOK)
+			return rc;
+
+		if (cnt)
+			*blocks_count = cnt;
+		return EOK;
+	}
+#endif
+
+	/* Block map: extend the run block by block */
+	rc = ext4_fs_get_inode_dblk_idx(inode_ref, iblock, fblock, true);
+	if (rc != EOK)
+		return rc;
+
+	for (cnt = 1; cnt < max_blocks; cnt++) {
+		rc = ext4_fs_get_inode_dblk_idx(inode_ref, iblock + cnt, &next,
+						true);
+		if (rc != EOK)
+			return rc;
+
+		if (*fblock ? next != *fblock + cnt : next != 0)
+			break;
+	}
+
+	*blocks_count = cnt;
+	return EOK;
+}
+
 int ext4_fs_init_inode_dblk_idx(struct ext4_inode_ref *inode_ref,
 				ext4_lblk_t iblock, ext4_fsblk_t *fblock)
 {
@@ -1469,6 +1923,68 @@ int ext4_fs_init_inode_dblk_idx(struct ext4_inode_ref *inode_ref,
 						   true, true);
 }
 
+int ext4_fs_init_inode_dblk_run(struct ext4_inode_ref *inode_ref,
+				ext4_lblk_t iblock, uint32_t max_blocks,
+				ext4_fsblk_t *fblock, uint32_t *blocks_count)
+{
+	*blocks_count = 1;
+#if CONFIG_EXTENT_ENABLE
+	struct ext4_fs *fs = inode_ref->fs;
+	if ((ext4_sb_feature_incom(&fs->sb, EXT4_FINCOM_EXTENTS)) &&
+	    (ext4_inode_has_flag(inode_ref->inode, EXT4_INODE_FLAG_EXTENTS))) {
+		int rc = ext4_extent_map_blocks(
+		    inode_ref, iblock, max_blocks, fblock,
+		    EXT4_EXT_MAP_CREATE | EXT4_EXT_MAP_NOZERO, blocks_count);
+		if (rc != EOK)
+			return rc;
+
+		ext4_assert(*fblock && *blocks_count);
+		return EOK;
+	}
+#endif
+	(void)max_blocks;
+	return ext4_fs_init_inode_dblk_idx(inode_ref, iblock, fblock);
+}
+
+int ext4_fs_prealloc_inode_dblks(struct ext4_inode_ref *inode_ref,
+				 ext4_lblk_t iblock, uint32_t max_blocks,
+				 uint32_t *blocks_count)
+{
+	*blocks_count = 0;
+#if CONFIG_EXTENT_ENABLE
+	struct ext4_fs *fs = inode_ref->fs;
+	if ((ext4_sb_feature_incom(&fs->sb, EXT4_FINCOM_EXTENTS)) &&
+	    (ext4_inode_has_flag(inode_ref->inode, EXT4_INODE_FLAG_EXTENTS))) {
+		ext4_fsblk_t fblock;
+		return ext4_extent_map_blocks(inode_ref, iblock, max_blocks,
+					      &fblock, EXT4_EXT_MAP_UNWRIT,
+					      blocks_count);
+	}
+#endif
+	(void)iblock;
+	(void)max_blocks;
+	return ENOTSUP;
+}
+
+int ext4_fs_punch_inode_dblks(struct ext4_inode_ref *inode_ref,
+			      ext4_lblk_t iblock, uint32_t count)
+{
+#if CONFIG_EXTENT_ENABLE
+	struct ext4_fs *fs = inode_ref->fs;
+	if ((ext4_sb_feature_incom(&fs->sb, EXT4_FINCOM_EXTENTS)) &&
+	    (ext4_inode_has_flag(inode_ref->inode, EXT4_INODE_FLAG_EXTENTS))) {
+		if (!count)
+			return EOK;
+
+		return ext4_extent_remove_space(inode_ref, iblock,
+						iblock + count - 1);
+	}
+#endif
+	(void)iblock;
+	(void)count;
+	return ENOTSUP;
+}
+
 static int ext4_fs_set_inode_data_block_index(struct ext4_inode_ref *inode_ref,
 				       ext4_lblk_t iblock, ext4_fsblk_t fblock)
 {
@@ -1635,8 +2151,9 @@ static int ext4_fs_set_inode_data_block_index(struct ext4_inode_ref *inode_ref,
 }
 
 
-int ext4_fs_append_inode_dblk(struct ext4_inode_ref *inode_ref,
-			      ext4_fsblk_t *fblock, ext4_lblk_t *iblock)
+int ext4_fs_append_inode_dblks(struct ext4_inode_ref *inode_ref,
+			       uint32_t max_blocks, ext4_fsblk_t *fblock,
+			       ext4_lblk_t *iblock, uint32_t *count)
 {
 #if CONFIG_EXTENT_ENABLE
 	/* Handle extents separately */
@@ -1649,20 +2166,40 @@ int ext4_fs_append_inode_dblk(struct ext4_inode_ref *inode_ref,
 		uint32_t block_size = ext4_sb_get_block_size(sb);
 		*iblock = (uint32_t)((inode_size + block_size - 1) / block_size);
 
-		rc = ext4_extent_get_blocks(inode_ref, *iblock, 1,
-						&current_fsblk, true, NULL);
+		rc = ext4_extent_map_blocks(inode_ref, *iblock, max_blocks,
+					    &current_fsblk,
+					    EXT4_EXT_MAP_CREATE |
+						EXT4_EXT_MAP_NOZERO,
+					    count);
 		if (rc != EOK)
 			return rc;
 
 		*fblock = current_fsblk;
-		ext4_assert(*fblock);
+		ext4_assert(*fblock && *count);
 
-		ext4_inode_set_size(inode_ref->inode, inode_size + block_size);
+		ext4_inode_set_size(inode_ref->inode,
+				    inode_size + (uint64_t)*count * block_size);
 		inode_ref->dirty = true;
 
 
 		return rc;
 	}
+#endif
+	*count = 1;
+	return ext4_fs_append_inode_dblk(inode_ref, fblock, iblock);
+}
+
+int ext4_fs_append_inode_dblk(struct ext4_inode_ref *inode_ref,
+			      ext4_fsblk_t *fblock, ext4_lblk_t *iblock)
+{
+#if CONFIG_EXTENT_ENABLE
+	/* Handle extents separately */
+	if ((ext4_sb_feature_incom(&inode_ref->fs->sb, EXT4_FINCOM_EXTENTS)) &&
+	    (ext4_inode_has_flag(inode_ref->inode, EXT4_INODE_FLAG_EXTENTS))) {
+		uint32_t count;
+		return ext4_fs_append_inode_dblks(inode_ref, 1, fblock, iblock,
+						  &count);
+	}
 #endif
 	struct ext4_sblock *sb = &inode_ref->fs->sb;
 
@@ -64,11 +64,40 @@ struct ext4_fs {
 
 	uint32_t last_inode_bg_id;
 
+	/**@brief Bumped whenever data blocks are released from an i-node.
+	 *        Open files drop their cached block mappings on a change. */
+	uint32_t map_gen;
+
+	/**@brief In-memory block group descriptor table, loaded a group at a
+	 *        time by @ref ext4_fs_get_block_group_ref. Changes and their
+	 *        checksums reach the descriptor blocks in
+	 *        @ref ext4_fs_bgd_sync (NULL - not allocated).*/
+	uint8_t *bgd;
+
+	/**@brief Per group state of the table (EXT4_FS_BGD_*).*/
+	uint8_t *bgd_state;
+
+	/**@brief Per group block cache owner of unsynced changes.*/
+	uint32_t *bgd_owner;
+
+	/**@brief Groups with unsynced changes.*/
+	uint32_t bgd_dirty;
+
+	/**@brief Table allocation was tried (too big or out of memory -
+	 *        descriptors are used straight from the block cache).*/
+	bool bgd_tried;
+
 	struct jbd_fs *jbd_fs;
 	struct jbd_journal *jbd_journal;
 	struct jbd_trans *curr_trans;
 };
 
+/**@brief Group descriptor loaded into the in-memory table.*/
+#define EXT4_FS_BGD_LOADED (1 << 0)
+
+/**@brief Group descriptor changed since the last table sync.*/
+#define EXT4_FS_BGD_DIRTY (1 << 1)
+
 struct ext4_block_group_ref {
 	struct ext4_block block;
 	struct ext4_bgroup *block_group;
@@ -164,6 +193,53 @@ int ext4_fs_get_block_group_ref(struct ext4_fs *fs, uint32_t bgid,
  */
 int ext4_fs_put_block_group_ref(struct ext4_block_group_ref *ref);
 
+/**@brief Write changed descriptors of the in-memory table, with fresh
+ *        checksums, into the descriptor blocks in the block cache.
+ * @param fs Filesystem
+ * @return Error code
+ */
+int ext4_fs_bgd_sync(struct ext4_fs *fs);
+
+/**@brief Forget the in-memory table, descriptors are loaded again from
+ *        the block cache (the journal replayed descriptor blocks).
+ * @param fs Filesystem
+ */
+void ext4_fs_bgd_drop(struct ext4_fs *fs);
+
+/**@brief Check whether metadata checksums are computed when their blocks
+ *        are written back (CONFIG_EXT4_CSUM_DEFER, write back caching
+ *        and no journal running).
+ * @param fs Filesystem
+ * @return true if checksum updates are deferred
+ */
+bool ext4_fs_csum_deferred(struct ext4_fs *fs);
+
+/**@brief Set the checksum of a changed block bitmap in its group
+ *        descriptor, now or when the bitmap block is written back.
+ *        A checksum known to be current is patched for the changed
+ *        bits rather than computed over the whole bitmap.
+ * @param bg_ref Reference to the block group
+ * @param b      Block bitmap
+ * @param first  First changed bit
+ * @param cnt    Number of changed bits, all of them flipped
+ */
+void ext4_fs_set_block_bitmap_csum(struct ext4_block_group_ref *bg_ref,
+				   struct ext4_block *b,
+				   uint32_t first, uint32_t cnt);
+
+/**@brief Set the checksum of a changed inode bitmap in its group
+ *        descriptor, now or when the bitmap block is written back.
+ *        A checksum known to be current is patched for the changed
+ *        bits rather than computed over the whole bitmap.
+ * @param bg_ref Reference to the block group
+ * @param b      Inode bitmap
+ * @param first  First changed bit
+ * @param cnt    Number of changed bits, all of them flipped
+ */
+void ext4_fs_set_inode_bitmap_csum(struct ext4_block_group_ref *bg_ref,
+				   struct ext4_block *b,
+				   uint32_t first, uint32_t cnt);
+
 /**@brief Get reference to i-node specified by index.
  * @param fs    Filesystem to find i-node on
  * @param index Index of i-node to load
@@ -241,6 +317,21 @@ int ext4_fs_get_inode_dblk_idx(struct ext4_inode_ref *inode_ref,
 				 ext4_lblk_t iblock, ext4_fsblk_t *fblock,
 				 bool support_unwritten);
 
+/**@brief Get physical address of a run of logical blocks of the i-node.
+ *        Extent mapped i-nodes need a single extent tree lookup.
+ * @param inode_ref    I-node to read block address from
+ * @param iblock       Logical index of the first block
+ * @param max_blocks   Most blocks to map (at least 1)
+ * @param fblock       Output physical block address of iblock
+ *                     (0 - hole or unwritten range)
+ * @param blocks_count Output number of blocks (at least 1) that follow
+ *                     fblock on disk, or that are all holes
+ * @return Error code
+ */
+int ext4_fs_get_inode_dblk_run(struct ext4_inode_ref *inode_ref,
+			       ext4_lblk_t iblock, uint32_t max_blocks,
+			       ext4_fsblk_t *fblock, uint32_t *blocks_count);
+
 /**@brief Initialize a part of unwritten range of the inode.
  * @param inode_ref I-node to proceed on.
  * @param iblock    Logical index of block
@@ -250,6 +341,43 @@ int ext4_fs_get_inode_dblk_idx(struct ext4_inode_ref *inode_ref,
 int ext4_fs_init_inode_dblk_idx(struct ext4_inode_ref *inode_ref,
 				  ext4_lblk_t iblock, ext4_fsblk_t *fblock);
 
+/**@brief Map a run of logical blocks for a write that overwrites all of
+ *        them. Holes are allocated and unwritten blocks are initialized
+ *        without zeroing them first. Block mapped i-nodes get one block.
+ * @param inode_ref    I-node to proceed on
+ * @param iblock       Logical index of the first block
+ * @param max_blocks   Most blocks to map (at least 1)
+ * @param fblock       Output physical block address of iblock
+ * @param blocks_count Output number of blocks mapped
+ * @return Error code
+ */
+int ext4_fs_init_inode_dblk_run(struct ext4_inode_ref *inode_ref,
+				ext4_lblk_t iblock, uint32_t max_blocks,
+				ext4_fsblk_t *fblock, uint32_t *blocks_count);
+
+/**@brief Preallocate holes of a run of logical blocks as unwritten
+ *        extents. Mapped blocks are skipped. The i-node size is not
+ *        changed.
+ * @param inode_ref    I-node to proceed on
+ * @param iblock       Logical index of the first block
+ * @param max_blocks   Most blocks to preallocate (at least 1)
+ * @param blocks_count Output number of blocks skipped or preallocated
+ * @return Error code (ENOTSUP - i-node does not use extents)
+ */
+int ext4_fs_prealloc_inode_dblks(struct ext4_inode_ref *inode_ref,
+				 ext4_lblk_t iblock, uint32_t max_blocks,
+				 uint32_t *blocks_count);
+
+/**@brief Release a range of data blocks inside the i-node, leaving a
+ *        hole. The i-node size is not changed.
+ * @param inode_ref I-node to proceed on
+ * @param iblock    Logical index of the first block
+ * @param count     Number of blocks (0 - only check the support)
+ * @return Error code (ENOTSUP - i-node does not use extents)
+ */
+int ext4_fs_punch_inode_dblks(struct ext4_inode_ref *inode_ref,
+			      ext4_lblk_t iblock, uint32_t count);
+
 /**@brief Append following logical block to the i-node.
  * @param inode_ref I-node to append block to
  * @param fblock    Output physical block address of newly allocated block
@@ -259,6 +387,22 @@ int ext4_fs_init_inode_dblk_idx(struct ext4_inode_ref *inode_ref,
 int ext4_fs_append_inode_dblk(struct ext4_inode_ref *inode_ref,
 			      ext4_fsblk_t *fblock, ext4_lblk_t *iblock);
 
+/**@brief Append up to max_blocks following logical blocks to the i-node.
+ *        Extent mapped i-nodes get one run of consecutive physical blocks
+ *        from a single allocation and a single extent insert, other
+ *        i-nodes get one block. Preallocated blocks past the end of the
+ *        file are not zeroed, the caller initializes them like new ones.
+ * @param inode_ref  I-node to append blocks to
+ * @param max_blocks Most blocks to append (at least 1)
+ * @param fblock     Output physical address of the first new block
+ * @param iblock     Output logical number of the first new block
+ * @param count      Output number of appended blocks
+ * @return Error code
+ */
+int ext4_fs_append_inode_dblks(struct ext4_inode_ref *inode_ref,
+			       uint32_t max_blocks, ext4_fsblk_t *fblock,
+			       ext4_lblk_t *iblock, uint32_t *count);
+
 /**@brief   Increment inode link count.
  * @param   inode none handle
  */
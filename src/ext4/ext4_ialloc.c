@@ -131,17 +131,21 @@ void ext4_ialloc_set_bitmap_csum(struct ext4_sblock *sb, struct ext4_bgroup *bg,
 #if CONFIG_META_CSUM_ENABLE
 static bool
 ext4_ialloc_verify_bitmap_csum(struct ext4_sblock *sb, struct ext4_bgroup *bg,
-			       void *bitmap __unused)
+			       struct ext4_block *b)
 {
-
 	int desc_size = ext4_sb_get_desc_size(sb);
-	uint32_t csum = ext4_ialloc_bitmap_csum(sb, bitmap);
-	uint16_t lo_csum = to_le16(csum & 0xFFFF),
-		 hi_csum = to_le16(csum >> 16);
 
 	if (!ext4_sb_feature_ro_com(sb, EXT4_FRO_COM_METADATA_CSUM))
 		return true;
 
+	/* The bitmap is verified once per read of its block */
+	if (ext4_bcache_test_verified(b->buf, EXT4_BCACHE_VERIFIED_BLOCK))
+		return true;
+
+	uint32_t csum = ext4_ialloc_bitmap_csum(sb, b->data);
+	uint16_t lo_csum = to_le16(csum & 0xFFFF),
+		 hi_csum = to_le16(csum >> 16);
+
 	if (bg->inode_bitmap_csum_lo != lo_csum)
 		return false;
 
@@ -149,6 +153,7 @@ ext4_ialloc_verify_bitmap_csum(struct ext4_sblock *sb, struct ext4_bgroup *bg,
 		if (bg->inode_bitmap_csum_hi != hi_csum)
 			return false;
 
+	ext4_bcache_set_verified(b->buf, EXT4_BCACHE_VERIFIED_BLOCK);
 	return true;
 }
 #else
@@ -178,7 +183,7 @@ int ext4_ialloc_free_inode(struct ext4_fs *fs, uint32_t index, bool is_dir)
 	if (rc != EOK)
 		return rc;
 
-	if (!ext4_ialloc_verify_bitmap_csum(sb, bg, b.data)) {
+	if (!ext4_ialloc_verify_bitmap_csum(sb, bg, &b)) {
 		ext4_dbg(DEBUG_IALLOC,
 			DBG_WARN "Bitmap checksum failed."
 			"Group: %" PRIu32"\n",
@@ -188,7 +193,7 @@ int ext4_ialloc_free_inode(struct ext4_fs *fs, uint32_t index, bool is_dir)
 	/* Free i-node in the bitmap */
 	uint32_t index_in_group = ext4_ialloc_inode_to_bgidx(sb, index);
 	ext4_bmap_bit_clr(b.data, index_in_group);
-	ext4_ialloc_set_bitmap_csum(sb, bg, b.data);
+	ext4_fs_set_inode_bitmap_csum(&bg_ref, &b, index_in_group, 1);
 	ext4_trans_set_block_dirty(b.buf);
 
 	/* Put back the block with bitmap */
@@ -271,7 +276,7 @@ int ext4_ialloc_alloc_inode(struct ext4_fs *fs, uint32_t *idx, bool is_dir)
 				return rc;
 			}
 
-			if (!ext4_ialloc_verify_bitmap_csum(sb, bg, b.data)) {
+			if (!ext4_ialloc_verify_bitmap_csum(sb, bg, &b)) {
 				ext4_dbg(DEBUG_IALLOC,
 					DBG_WARN "Bitmap checksum failed."
 					"Group: %" PRIu32"\n",
@@ -303,8 +308,7 @@ int ext4_ialloc_alloc_inode(struct ext4_fs *fs, uint32_t *idx, bool is_dir)
 			ext4_bmap_bit_set(b.data, idx_in_bg);
 
 			/* Free i-node found, save the bitmap */
-			ext4_ialloc_set_bitmap_csum(sb,bg,
-						    b.data);
+			ext4_fs_set_inode_bitmap_csum(&bg_ref, &b, idx_in_bg, 1);
 			ext4_trans_set_block_dirty(b.buf);
 
 			ext4_block_set(fs->bdev, &b);
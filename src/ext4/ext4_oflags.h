@@ -92,6 +92,15 @@ extern "C" {
  #include <fcntl.h>
 #endif
 
+/* Sparse file seek (@ref ext4_fseek), same values as Linux */
+#ifndef SEEK_DATA
+#define SEEK_DATA 3
+#endif
+
+#ifndef SEEK_HOLE
+#define SEEK_HOLE 4
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -57,6 +57,8 @@ int ext4_trans_set_block_dirty(struct ext4_buf *buf)
 
 	if (fs->jbd_journal && fs->curr_trans) {
 		struct jbd_trans *trans = fs->curr_trans;
+		/* The journal copies the block as it is */
+		ext4_bcache_csum_update(buf);
 		return jbd_trans_set_block_dirty(trans, &block);
 	}
 #endif